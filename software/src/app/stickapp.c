@@ -33,6 +33,15 @@ int main(int argc, char **argv) {
         printf("    -i, --init_device <masterKey>          Initialize device with specified unlock key\n");
         printf("    -u, --unlock_device <masterKey>        Unlock device\n");
         printf("    -s, --send <idName> <idUser> <idPass>  Send credential to device\n");
+        printf("    -d, --delete <idNum>                   Delete credential (1 is the first idName shown)\n");
+        printf("    -l, --layout <layout>                  Set keyboard layout (us, uk, de, fr)\n");
+        printf("    -n, --select <idNum>                   Show credential on device (1 is the first idName)\n");
+        printf("    -S, --status                           Show lock state, credential count and layout\n");
+        printf("    -t, --stats                            Show worst case timings of firmware tasks\n");
+        printf("    -r, --ram                              Show RAM high-water mark of the firmware\n");
+        printf("    -m, --mount                            Show work done mounting the store at boot\n");
+        printf("    -j, --job                              Show the job running on the store\n");
+        printf("    -q, --queue                            Show usage of the EEPROM write queue\n");
         printf("    -g, --generate                         Generate a complex password\n");
         printf("    -c, --clear                            Clear sensitive data from device\n");
         printf("    -b, --backup <file>                    Backup data from device to local file\n");
@@ -42,6 +51,7 @@ int main(int argc, char **argv) {
         printf("    <idName>    nickname associated with credential\n");
         printf("    <idUser>    username associated with credential\n");
         printf("    <idPass>    password associated with credential\n");
+        printf("    <layout>    keyboard layout of the computer the device types on\n");
         exit(1);
     }
 
@@ -56,6 +66,18 @@ int main(int argc, char **argv) {
         syslog(LOG_INFO, "Successfully opened device: VID=%04x PID=%04x", USB_VID, USB_PID);
     }
 
+    // the store must be idle for the requests changing or dumping it
+    if(!strcmp(argv[1], "--layout") || !strcmp(argv[1], "-l") ||
+       !strcmp(argv[1], "--delete") || !strcmp(argv[1], "-d") ||
+       !strcmp(argv[1], "--clear") || !strcmp(argv[1], "-c") ||
+       !strcmp(argv[1], "--send") || !strcmp(argv[1], "-s") ||
+       !strcmp(argv[1], "--backup") || !strcmp(argv[1], "-b")) {
+        if(waitStore(handle) < 0) {
+            syslog(LOG_INFO, "Error! device store still busy!");
+            exit(-1);
+        }
+    }
+
     // unlock device
     if(!strcmp(argv[1], "--unlock_device") || !strcmp(argv[1], "-u")) {
         // check length of unlock key
@@ -87,6 +109,162 @@ int main(int argc, char **argv) {
         syslog(LOG_INFO, "Sent %d bytes to USB device.\nDATA=%s", nBytes, tmpBuffer);
     }
 
+    // set keyboard layout
+    else if(!strcmp(argv[1], "--layout") || !strcmp(argv[1], "-l")) {
+        int layout;
+        for(layout = 0; layout < LAYOUT_COUNT; layout++) {
+            if(argc > 2 && !strcmp(argv[2], layoutNames[layout]))
+                break;
+        }
+        if(layout == LAYOUT_COUNT) {
+            syslog(LOG_INFO, "Error! layout must be one of us, uk, de, fr!");
+            exit(-1);
+        }
+        // the layout fits in wValue, the device answers if it took it
+        unsigned char status;
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_SET_LAYOUT, layout, 0, (char *)&status, 1, 5000);
+        if(nBytes != 1 || status != 0) {
+            syslog(LOG_INFO, "Error! device locked or busy!");
+            exit(-1);
+        }
+        syslog(LOG_INFO, "LAYOUT=%s", layoutNames[layout]);
+        // the device stores the layout once it is idle
+        if(waitStore(handle) < 0)
+            syslog(LOG_INFO, "Error! layout change not done yet!");
+    }
+
+    // show a credential on the device
+    else if(!strcmp(argv[1], "--select") || !strcmp(argv[1], "-n")) {
+        int idNum = (argc > 2) ? atoi(argv[2]) : 0;
+        unsigned char status;
+        if(idNum < 1 || idNum > 255) {
+            syslog(LOG_INFO, "Error! idNum must be between 1 and 255!");
+            exit(-1);
+        }
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_SELECT_CRED, idNum, 0, (char *)&status, 1, 5000);
+        if(nBytes != 1 || status != 0) {
+            syslog(LOG_INFO, "Error! device locked or no credential %d!", idNum);
+            exit(-1);
+        }
+    }
+
+    // show the state of the device
+    else if(!strcmp(argv[1], "--status") || !strcmp(argv[1], "-S")) {
+        unsigned char status[5];
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_GET_STATUS, 0, 0, (char *)status, sizeof(status), 5000);
+        if(nBytes != sizeof(status)) {
+            syslog(LOG_INFO, "Error! Received %d bytes instead of %d", nBytes, (int)sizeof(status));
+            exit(-1);
+        }
+        // unlocked, credentials, idName shown, layout then failed unlocks
+        printf("%s  credentials %d  shown %d  layout %s  failed unlocks %d\n",
+               status[0] ? "unlocked" : "locked", status[1], status[2],
+               (status[3] < LAYOUT_COUNT) ? layoutNames[status[3]] : "unknown", status[4]);
+    }
+
+    // delete a credential
+    else if(!strcmp(argv[1], "--delete") || !strcmp(argv[1], "-d")) {
+        int idNum = (argc > 2) ? atoi(argv[2]) : 0;
+        if(idNum < 1 || idNum > 255) {
+            syslog(LOG_INFO, "Error! idNum must be between 1 and 255!");
+            exit(-1);
+        }
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_DELETE_CRED, idNum, 0, 0, 0, 5000);
+        syslog(LOG_INFO, "Deleted credential %d", idNum);
+    }
+
+    // show scheduler statistics
+    else if(!strcmp(argv[1], "--stats") || !strcmp(argv[1], "-t")) {
+        unsigned char stats[TASK_COUNT * 3];
+        int i;
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_GET_STATS, 0, 0, (char *)stats, sizeof(stats), 5000);
+        if(nBytes != sizeof(stats)) {
+            syslog(LOG_INFO, "Error! Received %d bytes instead of %d", nBytes, (int)sizeof(stats));
+            exit(-1);
+        }
+        for(i = 0; i < TASK_COUNT; i++) {
+            printf("%-8s max latency %3d ms  max run %3d ms  overruns %3d\n",
+                   taskNames[i], stats[i * 3], stats[i * 3 + 1], stats[i * 3 + 2]);
+        }
+    }
+
+    // show RAM usage
+    else if(!strcmp(argv[1], "--ram") || !strcmp(argv[1], "-r")) {
+        unsigned char ram[6];
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_GET_RAM, 0, 0, (char *)ram, sizeof(ram), 5000);
+        if(nBytes != sizeof(ram)) {
+            syslog(LOG_INFO, "Error! Received %d bytes instead of %d", nBytes, (int)sizeof(ram));
+            exit(-1);
+        }
+        // 16 bit little endian values
+        printf("data %3d bytes  stack high-water %3d bytes  never used %3d bytes\n",
+               ram[0] | (ram[1] << 8), ram[2] | (ram[3] << 8), ram[4] | (ram[5] << 8));
+    }
+
+    // show how the store was mounted
+    else if(!strcmp(argv[1], "--mount") || !strcmp(argv[1], "-m")) {
+        unsigned char mount[4];
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_GET_MOUNT, 0, 0, (char *)mount, sizeof(mount), 5000);
+        if(nBytes != sizeof(mount)) {
+            syslog(LOG_INFO, "Error! Received %d bytes instead of %d", nBytes, (int)sizeof(mount));
+            exit(-1);
+        }
+        // 16 bit little endian time, records scanned, work redone
+        printf("mounted in %d ms  records scanned %d\n", mount[0] | (mount[1] << 8), mount[2]);
+        if(mount[3] & MOUNT_COMPACT)
+            printf("finished a compaction cut by a power loss\n");
+        if(mount[3] & MOUNT_COMMIT)
+            printf("finished a credential update cut by a power loss\n");
+    }
+
+    // show EEPROM write queue usage
+    else if(!strcmp(argv[1], "--queue") || !strcmp(argv[1], "-q")) {
+        unsigned char queue[9];
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_GET_QUEUE, 0, 0, (char *)queue, sizeof(queue), 5000);
+        if(nBytes != sizeof(queue)) {
+            syslog(LOG_INFO, "Error! Received %d bytes instead of %d", nBytes, (int)sizeof(queue));
+            exit(-1);
+        }
+        // depth then 16 bit little endian values
+        printf("max depth %d writes  writes stalled %d  longest drain %d ms\n",
+               queue[0], queue[1] | (queue[2] << 8), queue[3] | (queue[4] << 8));
+        printf("bytes only erased or only written %d  bytes erased and written %d\n",
+               queue[5] | (queue[6] << 8), queue[7] | (queue[8] << 8));
+    }
+
+    // show the job running on the store
+    else if(!strcmp(argv[1], "--job") || !strcmp(argv[1], "-j")) {
+        unsigned char job[5];
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_GET_JOB, 0, 0, (char *)job, sizeof(job), 5000);
+        if(nBytes != sizeof(job)) {
+            syslog(LOG_INFO, "Error! Received %d bytes instead of %d", nBytes, (int)sizeof(job));
+            exit(-1);
+        }
+        // job, requests waiting, 16 bit little endian steps then whether
+        // the last record was refused
+        printf("job %s  requests waiting %d  steps run %d%s\n",
+               (job[0] < JOB_COUNT) ? jobNames[job[0]] : "unknown", job[1], job[2] | (job[3] << 8),
+               job[4] ? "  last record refused" : "");
+    }
+
     // generate complex password
     else if(!strcmp(argv[1], "--generate") || !strcmp(argv[1], "-g")) {
         syslog(LOG_INFO, "Not implemented yet!");
@@ -94,7 +272,27 @@ int main(int argc, char **argv) {
 
     // backup data from device
     else if(!strcmp(argv[1], "--backup") || !strcmp(argv[1], "-b")) {
-        syslog(LOG_INFO, "Not implemented yet!");
+        unsigned char dump[BACKUP_LEN];
+        FILE *file;
+        if(argc < 3) {
+            syslog(LOG_INFO, "Error! backup file is needed!");
+            exit(-1);
+        }
+        // the store and its metadata up to the master key in one transfer
+        nBytes = usb_control_msg(handle,
+            USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+            USB_READ_EEPROM, 0, 0, (char *)dump, sizeof(dump), 5000);
+        if(nBytes != sizeof(dump)) {
+            syslog(LOG_INFO, "Error! device locked or busy, received %d bytes instead of %d", nBytes, (int)sizeof(dump));
+            exit(-1);
+        }
+        file = fopen(argv[2], "wb");
+        if(file == NULL || fwrite(dump, 1, sizeof(dump), file) != sizeof(dump)) {
+            syslog(LOG_INFO, "Error! could not write backup file!");
+            exit(-1);
+        }
+        fclose(file);
+        printf("%d bytes saved to %s\n", nBytes, argv[2]);
     }
 
     // clear device
@@ -115,166 +313,27 @@ int main(int argc, char **argv) {
 
     // send credential to device
     else if(!strcmp(argv[1], "--send") || !strcmp(argv[1], "-s")) {
-        if(strlen(argv[2]) > ID_NAME_LEN) {
-            syslog(LOG_INFO, "Error! idName must be less or equal to 10 characters!");
+        if(argc < 5) {
+            syslog(LOG_INFO, "Error! idName, idUsername and idPassword are needed!");
             exit(-1);
         }
-        if(strlen(argv[3]) > ID_USERNAME_LEN) {
-            syslog(LOG_INFO, "Error! idUsername must be less or equal to 32 characters!");
+
+        unsigned char record[RECORD_XFER_MAX];
+        int recordLen = makeRecord(&argv[2], record);
+        if(recordLen < 0)
             exit(-1);
-        }
-        if(strlen(argv[4]) > ID_PASSWORD_LEN) {
-            syslog(LOG_INFO, "Error! idName must be less or equal to 21 characters!");
+        if(sendRecord(handle, record, recordLen) < 0) {
+            syslog(LOG_INFO, "Error! device locked or full!");
             exit(-1);
         }
-        int i, flagDone, flagFull, bufPtr;
-        char tmpBuffer[8];
-        int state = STATE_ID_UPLOAD_INIT;
-        char idName[ID_NAME_LEN];
-        char idUsername[ID_USERNAME_LEN];
-        char idPassword[ID_PASSWORD_LEN];
-        memcpy(idName, argv[2], ID_NAME_LEN);
-        memcpy(idUsername, argv[3], ID_USERNAME_LEN);
-        memcpy(idPassword, argv[4], ID_PASSWORD_LEN);
-
-        flagDone = 0;
-        memset(tmpBuffer, 0, sizeof(tmpBuffer));
-        syslog(LOG_INFO, "Ready to roll");
-
-
-        while(!flagDone) {
-            switch(state) {
-                // send empty msg to signal that id upload has been initiated
-                case STATE_ID_UPLOAD_INIT:
-                    memset(tmpBuffer, 0, sizeof(tmpBuffer));
-                    tmpBuffer[0] = STATE_ID_UPLOAD_INIT;
-                    nBytes = usb_control_msg(handle,
-                             USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                             USB_ID_UPLOAD, 0, 0, (char *)tmpBuffer, sizeof(tmpBuffer), 5000);
-                    state = STATE_ID_NAME_SEND;
-                    syslog(LOG_INFO, "Sent signal to initiate id upload");
-                    break;
-
-                // send the idName
-                case STATE_ID_NAME_SEND:
-                    memset(tmpBuffer, 0, sizeof(tmpBuffer));
-                    flagFull = 0;
-                    bufPtr = 0;
-
-                    // send in chunks of 8 bytes
-                    while(!flagFull) {
-                        // store state in first byte of msg
-                        tmpBuffer[0] = STATE_ID_NAME_SEND;
-
-                        // fill rest of buffer
-                        for(i = 1; idName[bufPtr] != '\0' && i < 8; i++) {
-                            tmpBuffer[i] = idName[bufPtr];
-                            bufPtr++;
-                        }
-                        if(idName[bufPtr] == '\0') {
-                            flagFull = 1;
-                        }
-
-                        nBytes = usb_control_msg(handle,
-                                     USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                                     USB_ID_UPLOAD, 0, 0, (char *)tmpBuffer, i, 5000);
-                        syslog(LOG_INFO, "Sent %d bytes to USB device.\nDATA=%s", nBytes, tmpBuffer);
-                    }
-                    state = STATE_ID_NAME_DONE;
-                    break;
-
-                case STATE_ID_NAME_DONE:
-                    memset(tmpBuffer, 0, sizeof(tmpBuffer));
-                    tmpBuffer[0] = STATE_ID_NAME_DONE;
-                    nBytes = usb_control_msg(handle,
-                             USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                             USB_ID_UPLOAD, 0, 0, (char *)tmpBuffer, sizeof(tmpBuffer), 5000);
-                    state = STATE_ID_USERNAME_SEND;
-                    syslog(LOG_INFO, "Sent signal for idName done");
-                    break;
-
-                case STATE_ID_USERNAME_SEND:
-                    memset(tmpBuffer, 0, sizeof(tmpBuffer));
-                    flagFull = 0;
-                    bufPtr = 0;
-
-                    // send in chunks of 8 bytes
-                    while(!flagFull) {
-                        // store state in first byte of msg
-                        tmpBuffer[0] = STATE_ID_USERNAME_SEND;
-
-                        // fill rest of buffer
-                        for(i = 1; idUsername[bufPtr] != '\0' && i < 8; i++) {
-                            tmpBuffer[i] = idUsername[bufPtr];
-                            bufPtr++;
-                        }
-
-                        if(idUsername[bufPtr] == '\0') {
-                            syslog(LOG_DEBUG, "reached NULL!");
-                            flagFull = 1;
-                        }
-
-                        syslog(LOG_INFO, "Preparing to send:%s", tmpBuffer);
-                        nBytes = usb_control_msg(handle,
-                                     USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                                     USB_ID_UPLOAD, 0, 0, (char *)tmpBuffer, i, 5000);
-                        syslog(LOG_INFO, "Sent %d bytes to USB device.\nDATA=%s", nBytes, tmpBuffer);
-                    }
-                    state = STATE_ID_USERNAME_DONE;
-                    break;
-
-                case STATE_ID_USERNAME_DONE:
-                    memset(tmpBuffer, 0, sizeof(tmpBuffer));
-                    tmpBuffer[0] = STATE_ID_USERNAME_DONE;
-                    syslog(LOG_INFO, "Preparing to send:%s", tmpBuffer);
-                    nBytes = usb_control_msg(handle,
-                             USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                             USB_ID_UPLOAD, 0, 0, (char *)tmpBuffer, sizeof(tmpBuffer), 5000);
-                    state = STATE_ID_PASS_SEND;
-                    syslog(LOG_INFO, "Sent signal for idUsername done");
-                    break;
-
-                case STATE_ID_PASS_SEND:
-                    memset(tmpBuffer, 0, sizeof(tmpBuffer));
-                    flagFull = 0;
-                    bufPtr = 0;
-
-                    // send in chunks of 8 bytes
-                    while(!flagFull) {
-                        // store state in first byte of msg
-                        tmpBuffer[0] = STATE_ID_PASS_SEND;
-
-                        // fill rest of buffer
-                        for(i = 1; idPassword[bufPtr] != '\0' && i < 8; i++) {
-                            tmpBuffer[i] = idPassword[bufPtr];
-                            bufPtr++;
-                        }
-
-                        if(idPassword[bufPtr] == '\0') {
-                            syslog(LOG_DEBUG, "reached NULL!");
-                            flagFull = 1;
-                        }
-
-                        syslog(LOG_INFO, "Preparing to send:%s", tmpBuffer);
-                        nBytes = usb_control_msg(handle,
-                                     USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                                     USB_ID_UPLOAD, 0, 0, (char *)tmpBuffer, i, 5000);
-                        syslog(LOG_INFO, "Sent %d bytes to USB device.\nDATA=%s", nBytes, tmpBuffer);
-                    }
-                    state = STATE_ID_PASS_DONE;
-                    break;
-
-                case STATE_ID_PASS_DONE:
-                    memset(tmpBuffer, 0, sizeof(tmpBuffer));
-                    tmpBuffer[0] = STATE_ID_PASS_DONE;
-                    syslog(LOG_INFO, "Preparing to send:%s", tmpBuffer);
-                    nBytes = usb_control_msg(handle,
-                             USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                             USB_ID_UPLOAD, 0, 0, (char *)tmpBuffer, sizeof(tmpBuffer), 5000);
-                    flagDone = 1;
-                    syslog(LOG_INFO, "Sent signal for idPassword done");
-                    break;
-            }
+
+        // the record is added to the log once the last field is in
+        int stored = waitStore(handle);
+        if(stored < 0)
+            syslog(LOG_INFO, "Error! credential not stored yet!");
+        else if(stored > 0) {
+            syslog(LOG_INFO, "Error! device full, credential not stored!");
+            exit(-1);
         }
     }
 
@@ -287,6 +346,79 @@ int main(int argc, char **argv) {
     return 0;
 }
 
+/*
+ * Wait until the device runs no job on its store and has no request
+ * waiting, firmware without jobs never answers USB_GET_JOB and is idle
+ * Return 0 once idle, 1 once idle with the last record sent refused, -1
+ * on timeout
+ */
+int waitStore(usb_dev_handle *handle) {
+    unsigned char job[5];
+    int waited;
+
+    for(waited = 0; waited < STORE_TIMEOUT_MS; waited += STORE_POLL_MS) {
+        if(usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                           USB_GET_JOB, 0, 0, (char *)job, sizeof(job), 5000) != sizeof(job))
+            return 0;
+        if(job[0] == 0 && job[1] == 0)
+            return job[4] != 0;
+        usleep(STORE_POLL_MS * 1000);
+    }
+    return -1;
+}
+
+/*
+ * Build the record sent with USB_WRITE_RECORD for the fields in text: the
+ * record as the device stores it minus its flags byte, each field is
+ * [length][bytes]. The size of the record is printed
+ * Return the length of the record, -1 if a field is too long
+ */
+int makeRecord(char **text, unsigned char *record) {
+    int i, len, recordLen = 0;
+
+    if(strlen(text[0]) > ID_NAME_LEN) {
+        syslog(LOG_INFO, "Error! idName must be less or equal to 10 characters!");
+        return -1;
+    }
+    if(strlen(text[1]) > ID_USERNAME_LEN) {
+        syslog(LOG_INFO, "Error! idUsername must be less or equal to 32 characters!");
+        return -1;
+    }
+    if(strlen(text[2]) > ID_PASSWORD_LEN) {
+        syslog(LOG_INFO, "Error! idName must be less or equal to 21 characters!");
+        return -1;
+    }
+
+    for(i = 0; i < 3; i++) {
+        len = strlen(text[i]);
+        record[recordLen++] = len;
+        memcpy(&record[recordLen], text[i], len);
+        recordLen += len;
+    }
+    // the device adds the flags byte
+    printf("record %d bytes\n", recordLen + 1);
+    return recordLen;
+}
+
+/*
+ * Send a record built by makeRecord() in one transfer, the device stalls
+ * it while it makes room
+ * Return 0 once sent, -1 if the device refused it
+ */
+int sendRecord(usb_dev_handle *handle, unsigned char *record, int len) {
+    int tries, nBytes = 0;
+
+    for(tries = 0; tries < 2; tries++) {
+        nBytes = usb_control_msg(handle,
+                 USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
+                 USB_WRITE_RECORD, 0, 0, (char *)record, len, 5000);
+        syslog(LOG_INFO, "Sent %d bytes to USB device", nBytes);
+        if(nBytes == len || waitStore(handle) < 0)
+            break;
+    }
+    return (nBytes == len) ? 0 : -1;
+}
+
 int usbGetDescriptorString(usb_dev_handle *dev, int index, int langid, char *buf, int buflen) {
     char buffer[256];
     int rval, i;
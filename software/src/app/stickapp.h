@@ -15,22 +15,29 @@
 #define USB_CLEAR_EEPROM 2
 #define USB_UNLOCK_DEVICE 15
 #define USB_INIT_DEVICE 16
+#define USB_SET_LAYOUT 17
+#define USB_GET_STATS 18
+#define USB_GET_RAM 19
+#define USB_DELETE_CRED 20
+#define USB_GET_MOUNT 21
+#define USB_GET_JOB 22
+#define USB_GET_QUEUE 23
+#define USB_WRITE_RECORD 24
+#define USB_SELECT_CRED 27
+#define USB_GET_STATUS 28
+#define USB_READ_EEPROM 29
 
 #define USB_VID 0x16c0
 #define USB_PID 0x05dc
 
-#define USB_ID_UPLOAD (char)3
-#define STATE_ID_UPLOAD_INIT (char)4
-#define STATE_ID_NAME_SEND (char)5
-#define STATE_ID_NAME_DONE (char)6
-#define STATE_ID_USERNAME_SEND (char)7
-#define STATE_ID_USERNAME_DONE (char)8
-#define STATE_ID_PASS_SEND (char)9
-#define STATE_ID_PASS_DONE (char)10
-#define STATE_ID_UPLOAD_DONE (char)11
 #define STATE_UNLOCK_DEVICE (char)12
 #define STATE_INIT_DEVICE (char)13
 
+// longest record USB_WRITE_RECORD takes in its data stage
+#define RECORD_XFER_MAX 254
+// EEPROM bytes sent by USB_READ_EEPROM, everything below the master key
+#define BACKUP_LEN 0x1F9
+
 #define ID_NAME_LEN 10
 #define ID_USERNAME_LEN 32
 #define ID_PASSWORD_LEN 21
@@ -39,7 +46,31 @@
 char *vendorName = "alexandru@jora.ca";
 char *productName = "StickPass";
 
+// firmware tasks in scheduler order, USB_GET_STATS returns 3 bytes each
+char *taskNames[] = {"usb", "eeprom", "inject", "button"};
+#define TASK_COUNT 4
+
+// work redone by the last mount, bits of the last byte sent by USB_GET_MOUNT
+#define MOUNT_COMMIT 0x01
+#define MOUNT_COMPACT 0x02
+
+// jobs the firmware runs on its store, USB_GET_JOB returns the job, the
+// requests waiting for it and the steps run in 16 bits
+char *jobNames[] = {"idle", "compaction", "layout change", "deletion", "wipe"};
+#define JOB_COUNT 5
+
+// the device drops requests changing its store until it is idle again
+#define STORE_POLL_MS 20
+#define STORE_TIMEOUT_MS 10000
+
+// keyboard layouts in the order of LAYOUTS in the firmware Makefile
+char *layoutNames[] = {"us", "uk", "de", "fr"};
+#define LAYOUT_COUNT 4
+
 // prototypes
+int makeRecord(char **text, unsigned char *record);
+int sendRecord(usb_dev_handle *handle, unsigned char *record, int len);
+int waitStore(usb_dev_handle *handle);
 int usbGetDescriptorString(usb_dev_handle *dev, int index, int langid, char *buf, int buflen);
 usb_dev_handle *usbOpenDevice(int vendor, char *vendorName, int product,  char *productName);
 
@@ -0,0 +1,120 @@
+/*
+ * File: button.c
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Pushbutton event engine
+ * The pin change interrupt on PB3 timestamps every edge with the timer1
+ * tick and button_Poll() turns the debounced level into short, long and
+ * double press events. Nothing here waits so usbPoll() keeps being called
+ * while the button is held.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "button.h"
+#include "led.h"
+#include "timer1.h"
+
+// states of the press detection
+#define PB_IDLE 0
+#define PB_PRESSED 1
+#define PB_HELD 2
+#define PB_WAIT_DOUBLE 3
+
+// written by the pin change interrupt
+static volatile unsigned char pbEdge = 0;
+static volatile unsigned int pbEdgeTime;
+
+static unsigned char pbState = PB_IDLE;
+static unsigned int pbTime;
+static unsigned char pbEvent = BUTTON_NONE;
+
+// pin change on PB3, only remember when it happened
+ISR(PCINT0_vect, ISR_NOBLOCK) {
+    pbEdgeTime = timer1_Now();
+    pbEdge = 1;
+}
+
+/*
+ * Enable the pull-up and the pin change interrupt of the pushbutton
+ *
+ */
+void button_Init(void) {
+    PB_INIT();
+
+    // pin change interrupt on PB3 only (datasheet p.51)
+    PCMSK |= (1<<PCINT3);
+    GIMSK |= (1<<PCIE);
+}
+
+/*
+ * Run the press detection, must be called from the main loop
+ * A level is only trusted once no edge occurred for BUTTON_DEBOUNCE_MS
+ *
+ */
+void button_Poll(void) {
+    unsigned int now = timer1_Now();
+    unsigned int edgeTime;
+    unsigned char pressed;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // still bouncing
+        if(pbEdge && (unsigned int)(now - pbEdgeTime) < BUTTON_DEBOUNCE_MS)
+            return;
+        edgeTime = pbEdgeTime;
+        pbEdge = 0;
+    }
+
+    pressed = !(PINB & (1<<PB3));
+
+    switch(pbState) {
+        case PB_IDLE:
+            if(pressed) {
+                pbTime = edgeTime;
+                pbState = PB_PRESSED;
+            }
+            break;
+
+        case PB_PRESSED:
+            if(!pressed) {
+                // wait for a second press before calling it a short press
+                pbTime = edgeTime;
+                pbState = PB_WAIT_DOUBLE;
+            }
+            else if((unsigned int)(now - pbTime) >= BUTTON_LONG_MS) {
+                pbEvent = BUTTON_LONG;
+                pbState = PB_HELD;
+            }
+            break;
+
+        case PB_HELD:
+            if(!pressed)
+                pbState = PB_IDLE;
+            break;
+
+        case PB_WAIT_DOUBLE:
+            if(pressed) {
+                pbEvent = BUTTON_DOUBLE;
+                pbState = PB_HELD;
+            }
+            else if((unsigned int)(now - pbTime) >= BUTTON_DOUBLE_MS) {
+                pbEvent = BUTTON_SHORT;
+                pbState = PB_IDLE;
+            }
+            break;
+    }
+}
+
+/*
+ * Return the last button event and clear it
+ *
+ */
+unsigned char button_GetEvent(void) {
+    unsigned char event = pbEvent;
+    pbEvent = BUTTON_NONE;
+    return event;
+}
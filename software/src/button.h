@@ -0,0 +1,29 @@
+/*
+ * File: button.h
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ */
+
+#ifndef BUTTON_H
+#define BUTTON_H
+
+// events posted to the main loop
+#define BUTTON_NONE 0
+#define BUTTON_SHORT 1
+#define BUTTON_LONG 2
+#define BUTTON_DOUBLE 3
+
+// timings in ms
+#define BUTTON_DEBOUNCE_MS 20
+#define BUTTON_LONG_MS 1000
+#define BUTTON_DOUBLE_MS 250
+
+// prototypes
+void button_Init(void);
+void button_Poll(void);
+unsigned char button_GetEvent(void);
+
+#endif
@@ -7,52 +7,589 @@
  *
  */
 
-#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include "eequeue.h"
 #include "credentials.h"
+#include "hid.h"
 #include <string.h>
 #include "led.h"
 
 // init credCount to 0
 unsigned char credCount = 0;
 
+// addresses of the live credentials in the order of their idNames
+static int credAddr[CRED_MAX];
+
+// address of the first erased flags byte, no room is left until the
+// store is formatted
+static int logEnd = LOG_SIZE;
+
+// current slot of the metadata ring and its content, read by mountStore()
+static unsigned char metaSlot = META_SLOTS - 1;
+static unsigned char metaSeq = META_ERASED;
+static unsigned char metaGen = 0;
+static unsigned char metaConfig = META_ERASED;
+
+// job run by storeJobStep() and its state
+job_status_t storeJob = {JOB_IDLE, 0, 0, 0};
+static int jobSize;
+
+// move of a dead run of the log run by moveChunk(), none while moveLen is 0
+static int moveRun;
+static int moveLen = 0;
+static int moveEnd;
+static int moveSrc;
+static int moveNext;                // source address ending the step
+static unsigned char moveSteps;
+
+// record written by writeRecord(), none while uploadAddr is -1
+static int uploadAddr = -1;
+static int uploadLimit;             // end of the room made for it
+static int uploadLen;               // length byte of the field written
+static int uploadPtr;               // next byte of the field
+static unsigned char uploadField;
+static unsigned char uploadWaiting = 0;     // opened once the compaction is over
+
+// longest text of each field
+static const unsigned char fieldMax[FIELD_COUNT] = {ID_NAME_LEN, ID_USERNAME_LEN, ID_PASSWORD_LEN};
+
+// next log byte checked by scrubLog(), the log is scrubbed once it reaches
+// LOG_SIZE
+static int scrubPos = LOG_SIZE;
+
+/*
+ * Start job, run by storeJobStep()
+ *
+ */
+static void startJob(unsigned char job) {
+    storeJob.job = job;
+    storeJob.chunks = 0;
+}
+
+/*
+ * Find the current slot of the metadata ring, the one whose sequence is
+ * the newest. An erased ring leaves the config erased
+ *
+ */
+static void loadMeta(void) {
+    unsigned char slot, data[META_SLOT_LEN];
+
+    metaSlot = META_SLOTS - 1;
+    metaSeq = META_ERASED;
+    metaGen = 0;
+    metaConfig = META_ERASED;
+    for(slot = 0; slot < META_SLOTS; slot++) {
+        eequeue_ReadBlock(data, (const void *)(META_LOCATION + slot * META_SLOT_LEN), META_SLOT_LEN);
+        if(data[0] == META_ERASED)
+            continue;
+
+        // sequences wrap, the ring only spans a few of them
+        if(metaSeq == META_ERASED || (signed char)(data[0] - metaSeq) > 0) {
+            metaSlot = slot;
+            metaSeq = data[0];
+            metaGen = data[1];
+            metaConfig = data[2];
+        }
+    }
+}
+
+/*
+ * Write the generation and the config byte to the next slot of the
+ * metadata ring. The sequence is written last, a slot cut by a power loss
+ * keeps the sequence of the oldest slot or stays erased and is not used
+ *
+ */
+static void writeMeta(unsigned char gen, unsigned char config) {
+    unsigned char slot = (metaSlot + 1) % META_SLOTS;
+    int memPtr = META_LOCATION + slot * META_SLOT_LEN;
+
+    if(gen == metaGen && config == metaConfig)
+        return;
+
+    if(++metaSeq == META_ERASED)
+        metaSeq = 0;
+    eequeue_UpdateByte((uint8_t *)(memPtr + 1), gen);
+    eequeue_UpdateByte((uint8_t *)(memPtr + 2), config);
+    eequeue_UpdateByte((uint8_t *)memPtr, metaSeq);
+
+    metaSlot = slot;
+    metaGen = gen;
+    metaConfig = config;
+}
+
+/*
+ * Return the length of the record at addr, flags and length bytes included
+ *
+ */
+static unsigned char recordLen(int addr) {
+    unsigned char i, len = 1;
+
+    for(i = 0; i < FIELD_COUNT; i++)
+        len += 1 + (eequeue_ReadByte((const uint8_t *)(addr + len)) & FIELD_LEN_MASK);
+    return len;
+}
+
+/*
+ * Return non zero if the record at addr takes room in the log, pending or
+ * not. Tombstones are dead
+ *
+ */
+static unsigned char isLive(int addr) {
+    return eequeue_ReadByte((const uint8_t *)addr) & RECORD_LIVE;
+}
+
+/*
+ * Return non zero if the record at addr is a live credential
+ * A credential still pending is not live yet
+ *
+ */
+static unsigned char isLiveCred(int addr) {
+    return isLive(addr) && !(eequeue_ReadByte((const uint8_t *)addr) & RECORD_PENDING);
+}
+
+/*
+ * Return the address of live credential idNum (1 based), -1 if there is none
+ *
+ */
+static int findRecord(unsigned char idNum) {
+    if(idNum == 0 || idNum > credCount)
+        return -1;
+    return credAddr[idNum - 1];
+}
+
+/*
+ * Point cur at the start of a field of the record at addr
+ * A negative addr gives an empty field
+ *
+ */
+static void openRecordField(field_cursor_t *cur, int addr, unsigned char field) {
+    unsigned char i;
+    int memPtr = addr + 1;
+
+    cur->left = 0;
+    if(addr < 0)
+        return;
+
+    // skip the flags and the fields before
+    for(i = 0; i < field; i++)
+        memPtr += 1 + (eequeue_ReadByte((const uint8_t *)memPtr) & FIELD_LEN_MASK);
+
+    cur->addr = memPtr + 1;
+    cur->left = eequeue_ReadByte((const uint8_t *)memPtr) & FIELD_LEN_MASK;
+}
+
+/*
+ * Point cur at the start of a field of credential idNum (1 based)
+ * The record is never copied to RAM, injection reads it through the cursor.
+ * A missing credential gives an empty field
+ *
+ */
+void openField(field_cursor_t *cur, unsigned char idNum, unsigned char field) {
+    openRecordField(cur, findRecord(idNum), field);
+}
+
+/*
+ * Return the next character of the field and move the cursor past it
+ * Return '\0' at the end of the field
+ *
+ */
+char readField(field_cursor_t *cur) {
+    if(cur->left == 0)
+        return '\0';
+    cur->left--;
+    return eequeue_ReadByte((const uint8_t *)(cur->addr++));
+}
+
+/*
+ * Return the next character of the field without moving the cursor
+ *
+ */
+char peekField(const field_cursor_t *cur) {
+    field_cursor_t tmp = *cur;
+    return readField(&tmp);
+}
+
+/*
+ * Move the cursor n characters forward
+ *
+ */
+void skipField(field_cursor_t *cur, unsigned char n) {
+    while(n--)
+        readField(cur);
+}
+
+/*
+ * Turn the record at addr into a tombstone, its space is reclaimed by
+ * the next compaction
+ *
+ */
+static void killRecord(int addr) {
+    eequeue_UpdateByte((uint8_t *)addr, eequeue_ReadByte((const uint8_t *)addr) & ~RECORD_LIVE);
+}
+
+/*
+ * Compare the idNames of the records at a and b
+ * Return a negative number, 0 or a positive number as the first sorts
+ * before, like or after the second
+ *
+ */
+static int compareNames(int a, int b) {
+    field_cursor_t x, y;
+    char c, d;
+
+    openRecordField(&x, a, FIELD_NAME);
+    openRecordField(&y, b, FIELD_NAME);
+    do {
+        c = readField(&x);
+        d = readField(&y);
+    } while(c == d && c != '\0');
+    return (unsigned char)c - (unsigned char)d;
+}
+
+/*
+ * Return the index in credAddr of the live credential named like the
+ * record at addr, -1 if there is none
+ *
+ */
+static int findName(int addr) {
+    unsigned char i;
+
+    for(i = 0; i < credCount; i++) {
+        if(compareNames(addr, credAddr[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Add the live credential at addr to credAddr, after the idNames sorting
+ * before its own. There must be room left
+ *
+ */
+static void listCred(int addr) {
+    unsigned char i;
+
+    for(i = credCount++; i > 0 && compareNames(addr, credAddr[i - 1]) < 0; i--)
+        credAddr[i] = credAddr[i - 1];
+    credAddr[i] = addr;
+}
+
+/*
+ * Second phase of an append: turn the live record of the same name as the
+ * pending record at addr into a tombstone, then clear the pending flag.
+ * Either write alone leaves a store mountStore() can finish. The record
+ * takes the place of the credential replaced in credAddr
+ * Return the index of the credential replaced, -1 if there was none
+ *
+ */
+static int commitRecord(int addr) {
+    int i = findName(addr);
+
+    if(i >= 0)
+        killRecord(credAddr[i]);
+
+    eequeue_UpdateByte((uint8_t *)addr, eequeue_ReadByte((const uint8_t *)addr) & ~RECORD_PENDING);
+    if(i >= 0)
+        credAddr[i] = addr;
+    return i;
+}
+
+/*
+ * List the live credentials of the log in credAddr, credentials past
+ * CRED_MAX are left out. A live record still pending is committed first,
+ * the records read and the commits redone are added to stats
+ *
+ */
+static void indexLog(mount_stats_t *stats) {
+    int addr = 0;
+    unsigned char flags;
+
+    while(addr < LOG_SIZE && (flags = eequeue_ReadByte((const uint8_t *)addr)) != RECORD_ERASED) {
+        if(isLive(addr) && (flags & RECORD_PENDING)) {
+            commitRecord(addr);
+            stats->recovered |= MOUNT_COMMIT;
+        }
+        if(isLiveCred(addr) && credCount < CRED_MAX && findName(addr) < 0)
+            listCred(addr);
+        stats->scanned++;
+        addr += recordLen(addr);
+        wdt_reset();
+    }
+
+    // a record running past the log can only come from corruption
+    logEnd = (addr > LOG_SIZE) ? LOG_SIZE : addr;
+}
+
+/*
+ * Return the address of the journal byte counting the steps of the move
+ * of the dead run at run in the log ending at end
+ *
+ */
+static int journalStep(int run, int end) {
+    return JOURNAL_LOCATION + JOURNAL_MOVE_LEN + (unsigned int)(run + end) % JOURNAL_STEPS;
+}
+
+/*
+ * Start moving the records after the dead run [run, run + len) of the log
+ * ending at end down over it, from step on. Step n copies len bytes at
+ * most from run + (n + 1) * len so it never overwrites what it reads and
+ * is redone as a whole after a power loss, the last byte of the journal
+ * counts the steps done
+ *
+ */
+static void startMove(int run, int len, int end, unsigned char step) {
+    moveRun = run;
+    moveLen = len;
+    moveEnd = end;
+    moveSteps = step;
+    moveSrc = run + (step + 1) * len;
+    moveNext = moveSrc + len;
+    // every step was done, only the tail may be left to erase
+    if(moveSrc > end)
+        moveSrc = end;
+}
+
+/*
+ * Copy the next JOB_CHUNK bytes of the move started by startMove(), then
+ * erase the tail of the log so no copy of a deleted credential is left.
+ * The credentials that moved are then found at their new address
+ * Return 0 once the move is over
+ *
+ */
+static unsigned char moveChunk(void) {
+    unsigned char n;
+
+    for(n = 0; n < JOB_CHUNK && moveSrc < moveEnd + moveLen; n++) {
+        eequeue_UpdateByte((uint8_t *)(moveSrc - moveLen), (moveSrc < moveEnd) ?
+                           eequeue_ReadByte((const uint8_t *)moveSrc) : RECORD_ERASED);
+        moveSrc++;
+        // the last step is counted before the tail it reads is erased
+        if(moveSrc <= moveEnd && (moveSrc == moveEnd || moveSrc == moveNext)) {
+            eequeue_UpdateByte((uint8_t *)journalStep(moveRun, moveEnd), ++moveSteps);
+            moveNext += moveLen;
+        }
+    }
+    if(moveSrc < moveEnd + moveLen)
+        return 1;
+
+    for(n = 0; n < credCount; n++) {
+        if(credAddr[n] >= moveRun + moveLen)
+            credAddr[n] -= moveLen;
+    }
+    logEnd = moveEnd - moveLen;
+    eequeue_UpdateByte((uint8_t *)journalStep(moveRun, moveEnd), JOURNAL_IDLE);
+    moveLen = 0;
+    return 0;
+}
+
 /*
- *  Get the credential count and append credential to EEPROM memory
+ * Finish the move recorded in the journal, if any
+ * Return 1 if a move was running
+ *
+ */
+static unsigned char resumeMove(void) {
+    unsigned char data[JOURNAL_MOVE_LEN], step;
+    int run, end;
+
+    // a move cut while its journal was written has no step byte yet
+    eequeue_ReadBlock(data, (const void *)JOURNAL_LOCATION, JOURNAL_MOVE_LEN);
+    run = data[0] | ((data[3] & 0x01) << 8);
+    end = data[2] | ((data[3] & 0x04) << 6);
+    step = eequeue_ReadByte((const uint8_t *)journalStep(run, end));
+    if(step == JOURNAL_IDLE)
+        return 0;
+
+    startMove(run, data[1] | ((data[3] & 0x02) << 7), end, step);
+    while(moveChunk())
+        wdt_reset();
+    return 1;
+}
+
+/*
+ * Run a step of the compaction started by openRecord(): reclaim dead
+ * runs of the log, last first, until jobSize bytes are free at its end or
+ * no tombstone is left. The last runs have the fewest records after them
+ * to move. Each move is journaled so a power loss in the middle is
+ * finished by mountStore()
+ * Return 0 once the compaction is over
+ *
+ */
+static unsigned char compactChunk(void) {
+    unsigned char data[JOURNAL_MOVE_LEN];
+    int addr, run = -1, runEnd = -1;
+
+    if(moveLen && moveChunk())
+        return 1;
+
+    if(logEnd + jobSize <= LOG_SIZE)
+        return 0;
+
+    for(addr = 0; addr < logEnd; addr += recordLen(addr)) {
+        if(isLive(addr))
+            continue;
+        if(addr != runEnd)
+            run = addr;
+        runEnd = addr + recordLen(addr);
+    }
+    if(run < 0)
+        return 0;
+
+    // the step count is written last, it starts the move
+    data[0] = run;
+    data[1] = runEnd - run;
+    data[2] = logEnd;
+    data[3] = ((run >> 8) & 0x01) | (((runEnd - run) >> 7) & 0x02) | ((logEnd >> 6) & 0x04);
+    eequeue_UpdateBlock((const void *)data, (void *)JOURNAL_LOCATION, JOURNAL_MOVE_LEN);
+    eequeue_UpdateByte((uint8_t *)journalStep(run, logEnd), 0);
+
+    startMove(run, runEnd - run, logEnd, 0);
+    return 1;
+}
+
+/*
+ * Return the bytes taken by the live records of the log, the rest is free
+ * once compacted
+ *
+ */
+static int liveLen(void) {
+    int addr, len = 0;
+
+    for(addr = 0; addr < logEnd; addr += recordLen(addr)) {
+        if(isLive(addr))
+            len += recordLen(addr);
+    }
+    return len;
+}
+
+/*
+ *  Open a credential record at the end of the log, its fields are then
+ *  written by writeRecord() and closeField() as they arrive and
+ *  closeRecord() adds it to the log. Room is made for size bytes, the
+ *  largest record when 0
  *  Return 0 on success
+ *  Return STORE_BUSY if a compaction was started to make room, the record
+ *  is opened once it is over
  *  Return -1 if no more space is available
  *
  */
-int update_credential(cred_t cred) {
-    getCredCount();
+int openRecord(unsigned char size) {
+    uploadAddr = -1;
+    uploadWaiting = 0;
+    if(size == 0 || size > RECORD_MAX_LEN)
+        size = RECORD_MAX_LEN;
 
-    if(credCount == MAX_CRED) {
+    if(logEnd + size > LOG_SIZE && liveLen() < logEnd) {
+        jobSize = size;
+        uploadWaiting = 1;
+        startJob(JOB_COMPACT);
+        return STORE_BUSY;
+    }
+
+    if(logEnd + size > LOG_SIZE) {
         // signal that something is wrong
         LED_HIGH();
         return -1;
     }
 
-    int memPtr;
-    unsigned char idNameLen = sizeof(cred.idName);
-    unsigned char idUsernameLen = sizeof(cred.idUsername);
-    unsigned char idPasswordLen = sizeof(cred.idPassword);
+    // the fields follow the erased flags byte
+    uploadAddr = logEnd;
+    uploadLimit = logEnd + size;
+    uploadField = 0;
+    uploadLen = logEnd + 1;
+    uploadPtr = uploadLen + 1;
+    return 0;
+}
 
-    // eeprom credential memory pointer
-    memPtr = (credCount * ID_BLOCK_LEN);
+/*
+ *  Write the next byte of the field of the open record, bytes past the
+ *  room made or the length of the field are dropped
+ *
+ */
+void writeRecord(unsigned char c) {
+    if(uploadAddr < 0 || uploadField >= FIELD_COUNT || uploadPtr >= uploadLimit ||
+       uploadPtr - uploadLen > fieldMax[uploadField])
+        return;
 
-    // write idName to eeprom and increment memPtr to idUsername
-    eeprom_update_block((const void *)cred.idName, (void *)memPtr, idNameLen);
-    memPtr += ID_NAME_LEN;
+    eequeue_UpdateByte((uint8_t *)uploadPtr++, c);
+}
 
-    // write idUsername to eeprom and increment memPtr to idPassword
-    eeprom_update_block((const void *)cred.idUsername, (void *)memPtr, idUsernameLen);
-    memPtr += ID_USERNAME_LEN;
+/*
+ *  End the field of the open record
+ *
+ */
+void closeField(void) {
+    unsigned char len = uploadPtr - uploadLen - 1;
+
+    if(uploadAddr < 0 || uploadField >= FIELD_COUNT)
+        return;
+
+    // the length of the next field must fit too
+    if(uploadField + 1 < FIELD_COUNT && uploadPtr >= uploadLimit) {
+        uploadAddr = -1;
+        LED_HIGH();
+        return;
+    }
+
+    eequeue_UpdateByte((uint8_t *)uploadLen, len);
+    uploadField++;
+    uploadLen = uploadPtr;
+    uploadPtr = uploadLen + 1;
+}
+
+/*
+ *  Add the open record to the log once its fields are closed, replacing
+ *  the live credential of the same name. A new credential must leave
+ *  RECORD_MAX_LEN bytes of the log free so that any credential can still
+ *  be replaced once the log is full
+ *  Return 0 on success
+ *  Return -1 if the record is incomplete or is new and has no room left
+ *
+ */
+int closeRecord(void) {
+    int addr = uploadAddr;
+
+    uploadAddr = -1;
+    if(addr < 0 || uploadField < FIELD_COUNT)
+        return -1;
 
-    // write idPassword to eeprom
-    eeprom_update_block((const void *)cred.idPassword, (void *)memPtr, idPasswordLen);
+    // the log may be followed by records of a cleared store not scrubbed
+    // yet, it must end before the record exists
+    if(uploadLen < LOG_SIZE)
+        eequeue_UpdateByte((uint8_t *)uploadLen, RECORD_ERASED);
 
-    // increment global var credCount
-    credCount++;
-    eeprom_update_block((const void*)&credCount, (void *)CREDCOUNT_LOCATION, 1);
+    // the flags byte is written last, the record only exists once complete
+    // and stays pending until commitRecord()
+    eequeue_UpdateByte((uint8_t *)addr, RECORD_ERASED & ~RECORD_USED);
+    logEnd = uploadLen;
 
+    if(findName(addr) < 0 && (liveLen() + RECORD_MAX_LEN > LOG_SIZE || credCount >= CRED_MAX)) {
+        killRecord(addr);
+        LED_HIGH();
+        return -1;
+    }
+
+    if(commitRecord(addr) < 0)
+        listCred(addr);
+    return 0;
+}
+
+/*
+ * Turn live credential idNum (1 based) into a tombstone, its space is
+ * reclaimed by the next compaction
+ * Return 0 on success
+ * Return -1 if there is no such credential
+ *
+ */
+int deleteCredential(unsigned char idNum) {
+    int addr = findRecord(idNum);
+
+    if(addr < 0)
+        return -1;
+
+    killRecord(addr);
+    for(credCount--; idNum <= credCount; idNum++)
+        credAddr[idNum - 1] = credAddr[idNum];
     return 0;
 }
 
@@ -64,7 +601,7 @@ int update_credential(cred_t cred) {
  *
  */
 void getMasterKey(char *masterKey) {
-    eeprom_read_block(masterKey, (const void*)MASTERKEY_LOCATION, MASTERKEY_LEN);
+    eequeue_ReadBlock(masterKey, (const void*)MASTERKEY_LOCATION, MASTERKEY_LEN);
 }
 
 /*
@@ -73,79 +610,147 @@ void getMasterKey(char *masterKey) {
  *
  */
 void setMasterKey(char *masterKey) {
-    eeprom_update_block((const void *)masterKey, (void *)MASTERKEY_LOCATION, MASTERKEY_LEN);
+    eequeue_UpdateBlock((const void *)masterKey, (void *)MASTERKEY_LOCATION, MASTERKEY_LEN);
 }
 
 /*
- * Get credential information from EEPROM memory
- * Take an ID number and a cred_t structer and update the credential
- * from EEPROM in the cred structure
+ * Clear the credential store, the master key is only erased with
+ * flagResetKey. This also formats the store, the metadata ring keeps the
+ * keyboard layout and counts the clears.
+ * The clear is logical: erasing the first flags byte empties the log, a
+ * power loss before leaves the store as it was. The old records are erased
+ * later by a JOB_SCRUB job, a few bytes are written instead of the whole
+ * EEPROM
  *
  */
-void getCredentialData(unsigned char idNum, cred_t *cred) {
+void clearEEPROM(unsigned char flagResetKey) {
+    unsigned char layout = getLayout();
     int memPtr;
-    if(idNum == 0)
-        memPtr = 0;
-    else
-        memPtr = ((idNum - 1) * ID_BLOCK_LEN);
 
-    // read idName
-    eeprom_read_block(cred->idName, (const void *)memPtr, ID_NAME_LEN);
-    cred->idName[ID_NAME_LEN] = '\0';
+    // a store in another format holds no log yet, it must look empty with
+    // no move running once it is formatted
+    if((metaConfig & FORMAT_MASK) != STORE_FORMAT) {
+        eequeue_UpdateByte((uint8_t *)0, RECORD_ERASED);
+        for(memPtr = JOURNAL_LOCATION + JOURNAL_MOVE_LEN; memPtr < JOURNAL_LOCATION + JOURNAL_LEN; memPtr++)
+            eequeue_UpdateByte((uint8_t *)memPtr, JOURNAL_IDLE);
+    }
 
-    // read idUsername
-    memPtr += ID_NAME_LEN;
-    eeprom_read_block(cred->idUsername, (const void *)memPtr, ID_USERNAME_LEN);
-    cred->idUsername[ID_USERNAME_LEN] = '\0';
+    // mark the store as formatted and keep the layout, then empty the log
+    writeMeta(metaGen + 1, ((layout << LAYOUT_SHIFT) & LAYOUT_MASK) | STORE_FORMAT);
+    eequeue_UpdateByte((uint8_t *)0, RECORD_ERASED);
+    credCount = 0;
+    logEnd = 0;
+    uploadAddr = -1;
+    uploadWaiting = 0;
+    scrubPos = 0;
+    startJob(JOB_SCRUB);
 
-    // read idPassword
-    memPtr += ID_USERNAME_LEN;
-    eeprom_read_block(cred->idPassword, (const void *)memPtr, ID_PASSWORD_LEN);
-    cred->idPassword[ID_PASSWORD_LEN] = '\0';
+    // rewriting the key on every clear would wear it out
+    if(flagResetKey) {
+        for(memPtr = MASTERKEY_LOCATION; memPtr < MASTERKEY_LOCATION + MASTERKEY_LEN; memPtr++)
+            eequeue_UpdateByte((uint8_t *)memPtr, 0xFF);
+    }
 }
 
 /*
- * Clear memory before using cred_t structure
+ * Run a step of the wipe started by a clear: erase the next byte left
+ * after the end of the log, one byte per step so the wipe never holds the
+ * CPU for long. Nothing is written after the log end while it runs
+ * Return 0 once nothing is left to erase
  *
  */
-void clearCred(cred_t *cred) {
-    memset(cred->idName, 0, ID_NAME_LEN);
-    memset(cred->idUsername, 0, ID_USERNAME_LEN);
-    memset(cred->idPassword, 0, ID_PASSWORD_LEN);
+static unsigned char scrubLog(void) {
+    if(scrubPos < logEnd)
+        scrubPos = logEnd;
+
+    for(; scrubPos < LOG_SIZE; scrubPos++) {
+        if(eequeue_ReadByte((const uint8_t *)scrubPos) != RECORD_ERASED) {
+            eequeue_UpdateByte((uint8_t *)scrubPos++, RECORD_ERASED);
+            return 1;
+        }
+    }
+    return 0;
 }
 
 /*
- * Clear EEPROM by writing 0xFF on all 512 bytes
+ * Mount the store: list the live credentials and find the end of the log
+ * A compaction cut by a power loss is finished first, the log is then
+ * scanned once. Only the last record may still be pending.
+ * The work is bounded by one compaction and one scan of the log, the time
+ * it took is up to the caller.
+ * A store in another format holds no credential and has no room left
+ * until it is cleared
  *
  */
-void clearEEPROM(unsigned char flagResetKey) {
-    // backup masterKey
-    char masterKey[7];
-    getMasterKey(&masterKey[0]);
-
-    unsigned char i;
-    int memPtr;
-    unsigned char clear[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    for(i = 0; i < 64; i++) {
-        memPtr = (i * MAX_CRED);
-        eeprom_update_block((const void *)clear, (void *)memPtr, 8);
-    }
+void mountStore(mount_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    storeJob.job = JOB_IDLE;
     credCount = 0;
-    // set credCount to 0 in memory
-    eeprom_update_block((const void*)&credCount, (void *)CREDCOUNT_LOCATION, 1);
+    logEnd = LOG_SIZE;
+    uploadAddr = -1;
+    uploadWaiting = 0;
+    loadMeta();
+    if((metaConfig & FORMAT_MASK) != STORE_FORMAT)
+        return;
+
+    if(resumeMove())
+        stats->recovered |= MOUNT_COMPACT;
 
-    // restore the master key if key reset flag is false
-    if(!flagResetKey)
-        setMasterKey(&masterKey[0]);
+    indexLog(stats);
+
+    // a wipe may have been cut by the last unplug, the first step finds
+    // the log scrubbed otherwise
+    scrubPos = 0;
+    startJob(JOB_SCRUB);
 }
 
 /*
- * Obtain the credential count from the EEPROM memory
- * This is located at address 0x1F8
+ * Get the keyboard layout number kept in the config byte
+ * A store that never had one set (erased config byte, layout 7) types
+ * with LAYOUT_US like the device does
  *
  */
-void getCredCount(void) {
-    unsigned char data;
-    eeprom_read_block(&data, (const void*)CREDCOUNT_LOCATION, 1);
-    credCount = data;
+unsigned char getLayout(void) {
+    return knownLayout((metaConfig & LAYOUT_MASK) >> LAYOUT_SHIFT);
+}
+
+/*
+ * Store the keyboard layout number
+ * The format bits are kept so an unformatted store stays unusable
+ *
+ */
+void setLayout(unsigned char layout) {
+    writeMeta(metaGen, (metaConfig & ~LAYOUT_MASK) | ((layout << LAYOUT_SHIFT) & LAYOUT_MASK));
+}
+
+/*
+ * Run the next step of the job started, a step writes a record or
+ * JOB_CHUNK bytes at most so the caller keeps polling USB in between
+ * Return 0 once no job is left
+ *
+ */
+unsigned char storeJobStep(void) {
+    unsigned char more;
+
+    switch(storeJob.job) {
+        case JOB_COMPACT:
+            more = compactChunk();
+            break;
+
+        case JOB_SCRUB:
+            more = scrubLog();
+            break;
+
+        default:
+            return 0;
+    }
+
+    storeJob.chunks++;
+    if(!more) {
+        storeJob.job = JOB_IDLE;
+        // the host sends the fields once it sees the store idle
+        if(uploadWaiting)
+            openRecord(jobSize);
+    }
+    return more;
 }
@@ -13,37 +13,138 @@
 #include <string.h>
 #include <stdio.h>
 
-#define ID_BLOCK_LEN 63
 #define ID_NAME_LEN 10
 #define ID_USERNAME_LEN 32
 #define ID_PASSWORD_LEN 21
-#define MAX_CRED 8
 #define MASTERKEY_LEN 7
 
-// credcnt var is kept at eeprom location 0x1F8 (504)
-#define CREDCOUNT_LOCATION 0x1F8
+// credentials are appended to a log filling 0x000-0x1E4, each record is
+//     [flags][nameLen][name][usernameLen][username][passwordLen][password]
+// the log ends at the first record whose flags byte is erased
+#define LOG_SIZE JOURNAL_LOCATION
+#define RECORD_ERASED 0xFF
+// cleared once the whole record is written
+#define RECORD_USED 0x01
+// cleared once the record it replaces is a tombstone, a record still
+// pending at boot gets its replacement redone
+#define RECORD_PENDING 0x04
+// cleared when the record is deleted or replaced (tombstone)
+#define RECORD_LIVE 0x80
+#define FIELD_COUNT 3
+// flags, length bytes and the longest fields
+#define RECORD_MAX_LEN (1 + FIELD_COUNT + ID_NAME_LEN + ID_USERNAME_LEN + ID_PASSWORD_LEN)
+
+// field length bytes keep the length in bits 5-0, fields are ASCII
+#define FIELD_LEN_MASK 0x3F
+
+// most live credentials, mountStore() lists them in RAM in the order of
+// their idNames
+#define CRED_MAX 20
+
+// compaction journal kept at 0x1E5-0x1EC while a dead run of the log is
+// reclaimed by moving the records after it down in steps
+//     [run addr bits 7-0][run length bits 7-0][old log end bits 7-0]
+//     [bit 0 run addr bit 8, bit 1 run length bit 8, bit 2 log end bit 8]
+//     [steps done] x JOURNAL_STEPS
+// steps done is written last and is JOURNAL_IDLE when no move is running,
+// each move counts in the step byte picked by (run addr + old log end) so
+// the writes are spread over JOURNAL_STEPS bytes
+#define JOURNAL_MOVE_LEN 4
+#define JOURNAL_STEPS 4
+#define JOURNAL_LEN (JOURNAL_MOVE_LEN + JOURNAL_STEPS)
+#define JOURNAL_LOCATION (META_LOCATION - JOURNAL_LEN)
+#define JOURNAL_IDLE 0xFF
+
+// store metadata kept in a ring of slots at 0x1ED-0x1F8 so that no byte
+// takes every change, each slot is
+//     [sequence][generation][config]
+// the slot with the newest sequence is the current one. A change goes to
+// the next slot with its sequence written last, sequences skip META_ERASED.
+// generation counts the clears of the store, a clear only bumps it and
+// empties the log, the records left after the log end are scrubbed later
+#define META_SLOTS 4
+#define META_SLOT_LEN 3
+#define META_LOCATION (MASTERKEY_LOCATION - META_SLOTS * META_SLOT_LEN)
+#define META_ERASED 0xFF
+
+// bits 7 and 3-0 of the config byte tell the store format, devices with
+// fixed 63 byte slots kept their credential count (0-8) at 0x1F8 and must
+// be cleared like stores written before the directory (0x0A), the journal
+// (0x0B), the metadata ring (0x0C, config byte at 0x1F8), the generation in
+// the slot crc (0x0D), the layout in the record flags (0x0E) or with the
+// directory (0x09). Bit 7 was clear on all of them, 0x8F is an erased
+// config byte
+#define FORMAT_MASK 0x8F
+#define STORE_FORMAT 0x89
+
+// keyboard layout in bits 6-4 of the config byte
+#define LAYOUT_MASK 0x70
+#define LAYOUT_SHIFT 4
 
 // masterkey location in eeprom is 1F9 (505)
 #define MASTERKEY_LOCATION 0x1F9
 
-// structure storing credential related data
+// fields of a credential record in EEPROM order
+#define FIELD_NAME 0
+#define FIELD_USERNAME 1
+#define FIELD_PASSWORD 2
+
+// position in a credential field read from EEPROM one character at a time
 typedef struct {
-    char idName[ID_NAME_LEN + 1];
-    char idUsername[ID_USERNAME_LEN + 1];
-    char idPassword[ID_PASSWORD_LEN + 1];
-} cred_t;
+    int addr;               // EEPROM address of the next byte
+    unsigned char left;     // bytes left in the field
+} field_cursor_t;
+
+// work done by mountStore(), time is filled by the caller
+typedef struct {
+    unsigned int time;          // milliseconds
+    unsigned char scanned;      // records read
+    unsigned char recovered;    // MOUNT_* work redone after a power loss
+} mount_stats_t;
+
+#define MOUNT_COMMIT 0x01
+#define MOUNT_COMPACT 0x02
+
+// long store operation run a step at a time by storeJobStep(), pending
+// and failed are filled by the caller
+typedef struct {
+    unsigned char job;          // JOB_* running, JOB_IDLE once done
+    unsigned char pending;      // requests waiting for the job
+    unsigned int chunks;        // steps run by the current or last job
+    unsigned char failed;       // last record was refused
+} job_status_t;
+
+#define JOB_IDLE 0
+#define JOB_COMPACT 1
+#define JOB_SCRUB 4
+
+// bytes moved by a step of a compaction, 27 ms of EEPROM writes
+#define JOB_CHUNK 8
+
+// returned by updates waiting for a compaction to make room
+#define STORE_BUSY 1
 
-// global variable to keep track of number of credentials in eeprom
+// global variable to keep track of number of live credentials in eeprom
 extern unsigned char credCount;
+extern job_status_t storeJob;
 
 // prototypes
-int update_credential(cred_t cred);
-void getCredentialData(unsigned char idNum, cred_t *cred);
-void clearCred(cred_t *cred);
+int openRecord(unsigned char size);
+void writeRecord(unsigned char c);
+void closeField(void);
+int closeRecord(void);
+int deleteCredential(unsigned char idNum);
+void openField(field_cursor_t *cur, unsigned char idNum, unsigned char field);
+char readField(field_cursor_t *cur);
+char peekField(const field_cursor_t *cur);
+void skipField(field_cursor_t *cur, unsigned char n);
 void clearEEPROM(unsigned char flagResetKey);
-void getCredCount(void);
+void mountStore(mount_stats_t *stats);
 void getMasterKey(char *masterKey);
 void setMasterKey(char *masterKey);
+unsigned char getLayout(void);
+void setLayout(unsigned char layout);
+unsigned char storeJobStep(void);
 
 #endif
 
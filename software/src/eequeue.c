@@ -0,0 +1,222 @@
+/*
+ * File: eequeue.c
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * EEPROM writes queued and programmed from the EEPROM ready interrupt
+ * A byte takes 3.4ms to erase and write, the caller only waits when the
+ * queue is full or when it reads a byte that is not queued while one is
+ * being programmed. Bytes that only need bits cleared are written without
+ * the erase and bytes set to 0xFF are only erased, each in 1.8ms
+ * (datasheet p.20). The credential log is appended over erased space so
+ * most of its writes take the short path. Writes reach the EEPROM in the
+ * order they were queued so a power loss cuts the sequence like it did
+ * with avr-libc. Interrupts must be enabled for the queue to drain. The
+ * statistics are only kept in builds with STATS set.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "eequeue.h"
+#include "timer1.h"
+
+// ring of queued writes, the oldest at head
+static unsigned int queueAddr[EEQUEUE_DEPTH];
+static unsigned char queueValue[EEQUEUE_DEPTH];
+static unsigned char head = 0;
+static volatile unsigned char count = 0;
+
+#if STATS
+// time the queue stopped being empty
+static unsigned int drainStart;
+static eequeue_stats_t queueStats;
+#endif
+
+/*
+ * Read the EEPROM byte at addr, no write may be in progress
+ *
+ */
+static unsigned char readCell(unsigned int addr) {
+    EEAR = addr;
+    EECR |= (1<<EERE);
+    return EEDR;
+}
+
+/*
+ * Return the programming mode (EEPM bits) turning old into value
+ * Erasing sets every bit and writing can only clear bits
+ *
+ */
+static unsigned char programMode(unsigned char old, unsigned char value) {
+    if(value == 0xFF) {
+#if STATS
+        queueStats.split++;
+#endif
+        return (1<<EEPM0);
+    }
+    if((old & value) == value) {
+#if STATS
+        queueStats.split++;
+#endif
+        return (1<<EEPM1);
+    }
+#if STATS
+    queueStats.atomic++;
+#endif
+    return 0;
+}
+
+/*
+ * Program the next queued byte that differs from the EEPROM, bytes already
+ * holding their value are dropped. Runs from EE_RDY_vect with interrupts
+ * enabled and the EEPROM ready interrupt masked, which is unmasked again
+ * while a byte is programmed
+ *
+ */
+ISR(__vector_eequeue_next) {
+    unsigned int addr;
+    unsigned char old, value;
+
+    while(count) {
+        addr = queueAddr[head];
+        value = queueValue[head];
+        head = (head + 1) % EEQUEUE_DEPTH;
+        count--;
+
+        old = readCell(addr);
+        if(old != value) {
+            EEAR = addr;
+            EEDR = value;
+            EECR = programMode(old, value);
+            // EEPE must follow EEMPE within 4 cycles
+            cli();
+            EECR |= (1<<EEMPE);
+            EECR |= (1<<EEPE);
+            sei();
+            EECR |= (1<<EERIE);
+            return;
+        }
+    }
+
+#if STATS
+    unsigned int elapsed = timer1_Now() - drainStart;
+    if(elapsed > queueStats.maxDrain)
+        queueStats.maxDrain = elapsed;
+#endif
+}
+
+// the interrupt stays pending while the EEPROM is ready, it is masked
+// before interrupts are enabled so the USB interrupt is never delayed
+ISR(EE_RDY_vect, ISR_NAKED) {
+    __asm__ volatile (
+        "    cbi %0, %1\n"
+        "    sei\n"
+        "    rjmp __vector_eequeue_next\n"
+        :
+        : "I" (_SFR_IO_ADDR(EECR)), "I" (EERIE)
+    );
+}
+
+/*
+ * Return the EEPROM byte at addr, the last value queued for it if any
+ *
+ */
+uint8_t eequeue_ReadByte(const uint8_t *addr) {
+    unsigned char i, value, sreg = SREG;
+
+    cli();
+    for(i = count; i > 0; i--) {
+        if(queueAddr[(head + i - 1) % EEQUEUE_DEPTH] == (unsigned int)addr) {
+            value = queueValue[(head + i - 1) % EEQUEUE_DEPTH];
+            SREG = sreg;
+            return value;
+        }
+    }
+
+    // the queue holds while the byte being programmed is waited for
+    EECR &= ~(1<<EERIE);
+    SREG = sreg;
+    while(EECR & (1<<EEPE));
+    value = readCell((unsigned int)addr);
+    if(count)
+        EECR |= (1<<EERIE);
+    return value;
+}
+
+/*
+ * Queue writing value at addr, the byte is left alone if it holds value
+ * by then. Waits for room when the queue is full
+ *
+ */
+void eequeue_UpdateByte(uint8_t *addr, uint8_t value) {
+    unsigned char tail, sreg;
+
+    if(count == EEQUEUE_DEPTH) {
+#if STATS
+        queueStats.stalls++;
+#endif
+        while(count == EEQUEUE_DEPTH);
+    }
+
+    sreg = SREG;
+    cli();
+    tail = (head + count + EEQUEUE_DEPTH - 1) % EEQUEUE_DEPTH;
+    if(count && queueAddr[tail] == (unsigned int)addr) {
+        // the last write queued is replaced, nothing was written after it
+        queueValue[tail] = value;
+    }
+    else {
+#if STATS
+        if(count == 0)
+            drainStart = timer1_Now();
+#endif
+        tail = (tail + 1) % EEQUEUE_DEPTH;
+        queueAddr[tail] = (unsigned int)addr;
+        queueValue[tail] = value;
+        count++;
+#if STATS
+        if(count > queueStats.maxDepth)
+            queueStats.maxDepth = count;
+#endif
+    }
+    EECR |= (1<<EERIE);
+    SREG = sreg;
+}
+
+/*
+ * Read n bytes from EEPROM at src to dst
+ *
+ */
+void eequeue_ReadBlock(void *dst, const void *src, size_t n) {
+    size_t i;
+
+    for(i = 0; i < n; i++)
+        ((uint8_t *)dst)[i] = eequeue_ReadByte((const uint8_t *)src + i);
+}
+
+/*
+ * Queue writing n bytes from src to EEPROM at dst
+ *
+ */
+void eequeue_UpdateBlock(const void *src, void *dst, size_t n) {
+    size_t i;
+
+    for(i = 0; i < n; i++)
+        eequeue_UpdateByte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+#if STATS
+/*
+ * Copy the queue statistics
+ *
+ */
+void eequeue_GetStats(eequeue_stats_t *stats) {
+    unsigned char sreg = SREG;
+
+    cli();
+    *stats = queueStats;
+    SREG = sreg;
+}
+#endif
@@ -0,0 +1,37 @@
+/*
+ * File: eequeue.h
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ */
+
+#ifndef EEQUEUE_H
+#define EEQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// EEPROM writes waiting for the one being programmed, 3 bytes of RAM each,
+// a power of two. The static data and the deepest call chain with every
+// interrupt nested on it take about 440 of the 512 bytes with 16
+#define EEQUEUE_DEPTH 16
+
+// queue statistics since reset, sent to the host as is (little endian)
+typedef struct {
+    unsigned char maxDepth;     // most writes queued at once
+    unsigned int stalls;        // writes that waited for room in the queue
+    unsigned int maxDrain;      // longest time in ms before the queue emptied
+    unsigned int split;         // bytes only erased or only written (1.8ms)
+    unsigned int atomic;        // bytes erased and written (3.4ms)
+} eequeue_stats_t;
+
+// prototypes, same arguments as the avr-libc functions they replace
+uint8_t eequeue_ReadByte(const uint8_t *addr);
+void eequeue_UpdateByte(uint8_t *addr, uint8_t value);
+void eequeue_ReadBlock(void *dst, const void *src, size_t n);
+void eequeue_UpdateBlock(const void *src, void *dst, size_t n);
+void eequeue_GetStats(eequeue_stats_t *stats);
+
+#endif
@@ -7,122 +7,188 @@
  *
  */
 
+#include <avr/pgmspace.h>
 #include "hid.h"
+#include "keymap.h"
 
 // global keyboard_report variable
 extern keyboard_report_t keyboard_report;
 
+// layout used for lookups, cached here to keep EEPROM out of the hot path
+static unsigned char activeLayout = LAYOUT_US;
+
+// set once a dead key was pressed and still needs its space
+static unsigned char deadPending = 0;
+
+/*
+ * Select the keyboard layout used to type characters
+ * Return 0 on success
+ * Return -1 if the layout does not exist
+ *
+ */
+int setKeyboardLayout(unsigned char layout) {
+    if(layout >= KEYMAP_LAYOUTS)
+        return -1;
+
+    activeLayout = layout;
+    return 0;
+}
+
+/*
+ * Return the packed keymap entry for input character
+ * Entries come from the flash table generated by layouts/keymapgen so the
+ * lookup costs the same for every character. Unsupported chars return 0
+ */
+static unsigned char keymapCode(unsigned char sendKey) {
+    if(sendKey == KEY_BS)
+        return HID_KEY_BACKSPACE;
+
+    if(sendKey == KEY_TAB)
+        return HID_KEY_TAB;
+
+    // unsigned wrap also rejects chars below KEYMAP_FIRST
+    if((unsigned char)(sendKey - KEYMAP_FIRST) >= KEYMAP_LEN)
+        return 0;
+
+    return pgm_read_byte(&keymap[activeLayout][sendKey - KEYMAP_FIRST]);
+}
+
+/*
+ * Return non zero if input character is typed with a dead key
+ */
+static unsigned char isDeadKey(unsigned char sendKey) {
+    unsigned char i = sendKey - KEYMAP_FIRST;
+
+    if(i >= KEYMAP_LEN)
+        return 0;
+
+    return pgm_read_byte(&keymapDead[activeLayout][i / 8]) & (1 << (i % 8));
+}
+
+/*
+ * Return the layout used to type characters
+ */
+unsigned char getKeyboardLayout(void) {
+    return activeLayout;
+}
+
+/*
+ * Return layout if the keymap holds it, LAYOUT_US otherwise
+ */
+unsigned char knownLayout(unsigned char layout) {
+    return (layout < KEYMAP_LAYOUTS) ? layout : LAYOUT_US;
+}
+
+/*
+ * Return HID code for a packed keymap entry
+ * The modifier needed for the key is stored in *modifier
+ */
+static unsigned char codeKey(unsigned char code, unsigned char *modifier) {
+    *modifier = 0;
+    if(code & KEYMAP_SHIFT)
+        *modifier |= MOD_LEFT_SHIFT;
+    if(code & KEYMAP_ALTGR)
+        *modifier |= MOD_RIGHT_ALT;
+
+    code &= KEYMAP_KEY_MASK;
+    if(code == KEYMAP_KEY_NONUS_BS)
+        return HID_KEY_NONUS_BS;
+
+    return code;
+}
+
 /*
  * Return HID code for input character
+ * The modifier needed for the character is stored in *modifier
  */
-void buildReport(unsigned char sendKey) {
-    // by default no modifier
-    keyboard_report.modifier = 0;
+static unsigned char lookupKey(unsigned char sendKey, unsigned char *modifier) {
+    return codeKey(keymapCode(sendKey), modifier);
+}
 
-    // handle empty report
-    if(sendKey == 0) {
-        keyboard_report.keycode = 0;
-        return;
-    }
+/*
+ * Build a report pressing a single key
+ */
+void buildReport(unsigned char sendKey) {
+    unsigned char modifier;
 
-    // handle backspace
-    if(sendKey == KEY_BS) {
-        keyboard_report.modifier = 2;
-        keyboard_report.keycode = 0x2A;
-        return;
-    }
+    clearKeyboardReport();
+    keyboard_report.keycode[0] = lookupKey(sendKey, &modifier);
+    keyboard_report.modifier = modifier;
+}
 
-    // handle TAB
-    if(sendKey == KEY_TAB) {
-        keyboard_report.keycode = 0x2B;
-        return;
+/*
+ * Return 1 if keycode is present in the key array of a report
+ */
+static unsigned char isKeyIn(const uint8_t *keys, unsigned char keycode) {
+    unsigned char i;
+    for(i = 0; i < REPORT_KEYS; i++) {
+        if(keys[i] == keycode)
+            return 1;
     }
+    return 0;
+}
 
-    // handle lowercase chars
-    if(sendKey >= 'a' && sendKey <= 'z') {
-        keyboard_report.keycode = 4 + (sendKey - 'a');
-        return;
+/*
+ * Build the next report needed to type str, starting from the report
+ * currently held by the host.
+ * Up to maxKeys characters sharing the same modifier are pressed at once.
+ * Hosts generate key down events in array order so the characters are
+ * typed in the same order as they appear in str.
+ * Keys are only released when the next character repeats a held key, any
+ * other transition is done directly and the modifier stays pressed across
+ * characters needing the same one.
+ * A dead key is pressed alone and the character is consumed with the space
+ * sent in the next report.
+ * Return the number of characters consumed from str, 0 when a release
+ * or a dead key report had to be built first
+ */
+unsigned char buildReportRun(const char *str, unsigned char maxKeys) {
+    unsigned char i, n, keycode, modifier;
+    uint8_t held[REPORT_KEYS];
+
+    // keep a copy of the keys held by the host and start from an empty array
+    for(i = 0; i < REPORT_KEYS; i++) {
+        held[i] = keyboard_report.keycode[i];
+        keyboard_report.keycode[i] = 0;
     }
 
-    // handle uppercase chars
-    if(sendKey >= 'A' && sendKey <= 'Z') {
-        keyboard_report.modifier = 2;
-        keyboard_report.keycode = 4 + (sendKey - 'A');
-        return;
-    }
+    if(maxKeys > REPORT_KEYS)
+        maxKeys = REPORT_KEYS;
 
-    // handle digits 1 to 9
-    if(sendKey >= '1' && sendKey <= '9') {
-        keyboard_report.keycode = 30 + (sendKey - '1');
-        return;
+    // complete the dead key pressed by the previous report
+    if(deadPending) {
+        deadPending = 0;
+        if(str[0] != '\0' && isDeadKey(str[0])) {
+            keyboard_report.modifier = 0;
+            keyboard_report.keycode[0] = HID_KEY_SPACE;
+            return 1;
+        }
     }
 
-    // handle rest of chars
-    else {
-        keyboard_report.modifier = 2;
-        switch(sendKey) {
-
-            case '0':
-                keyboard_report.modifier = 0;
-                keyboard_report.keycode = 0x27;
-                break;
-
-            case '@':
-                keyboard_report.keycode = 0x1F;
-                break;
-
-            case '#':
-                keyboard_report.keycode = 0x20;
-                break;
-
-            case '$':
-                keyboard_report.keycode = 0x21;
-                break;
-
-            case '%':
-                keyboard_report.keycode = 0x22;
-                break;
-
-            case '^':
-                keyboard_report.keycode = 0x23;
-                break;
-
-            case '&':
-                keyboard_report.keycode = 0x24;
-                break;
-
-            case '*':
-                keyboard_report.keycode = 0x25;
-                break;
-
-            case '(':
-                keyboard_report.keycode = 0x26;
-                break;
-
-            case ')':
-                keyboard_report.keycode = 0x27;
-                break;
-
-            case '_':
-                keyboard_report.keycode = 0x2D;
-                break;
-
-            case '.':
-                keyboard_report.modifier = 0;
-                keyboard_report.keycode = 0x37;
-                break;
-
-            case ' ':
-                keyboard_report.modifier = 0;
-                keyboard_report.keycode = 0x2C;
-                break;
-
-            // send NULL for unsupported chars
-            default:
-                keyboard_report.keycode = 0;
-                break;
+    for(n = 0; n < maxKeys && str[n] != '\0'; n++) {
+        keycode = lookupKey(str[n], &modifier);
+
+        if(n == 0)
+            keyboard_report.modifier = modifier;
+        else if(keycode == 0 || modifier != keyboard_report.modifier)
+            break;
+
+        // a key still held or already in the run needs a release first
+        if(keycode != 0 && (isKeyIn(held, keycode) || isKeyIn(keyboard_report.keycode, keycode)))
+            break;
+
+        // nothing can follow a dead key in the same report
+        if(isDeadKey(str[n])) {
+            if(n == 0) {
+                keyboard_report.keycode[0] = keycode;
+                deadPending = 1;
+            }
+            break;
         }
+
+        keyboard_report.keycode[n] = keycode;
     }
+    return n;
 }
 
 void clearKeyboardReport(void) {
@@ -14,15 +14,39 @@
 #define KEY_BS  0x08
 #define KEY_TAB 0x09
 
+// HID usage codes of the keys typed outside of the keymap
+#define HID_KEY_BACKSPACE 0x2A
+#define HID_KEY_TAB 0x2B
+#define HID_KEY_SPACE 0x2C
+#define HID_KEY_NONUS_BS 0x64
+
+// modifier bits of the report
+#define MOD_LEFT_SHIFT 0x02
+#define MOD_RIGHT_ALT 0x40
+
+// keymap entries pack the modifiers in bits 7-6 and the key in bits 5-0
+#define KEYMAP_SHIFT 0x40
+#define KEYMAP_ALTGR 0x80
+#define KEYMAP_KEY_MASK 0x3F
+// 0x64 does not fit in 6 bits and uses the otherwise unused key 0x3F
+#define KEYMAP_KEY_NONUS_BS 0x3F
+
+// number of keycode slots in the boot keyboard report (REPORT_COUNT 6)
+#define REPORT_KEYS 6
+
 typedef struct {
         uint8_t modifier;
         uint8_t reserved;
-        uint8_t keycode;
+        uint8_t keycode[REPORT_KEYS];
 } keyboard_report_t;
 
 // function prototypes
 void buildReport(unsigned char sendKey);
+unsigned char buildReportRun(const char *str, unsigned char maxKeys);
+unsigned char getKeyboardLayout(void);
+unsigned char knownLayout(unsigned char layout);
 void clearKeyboardReport(void);
+int setKeyboardLayout(unsigned char layout);
 
 #endif
 
@@ -0,0 +1,257 @@
+/*
+ * File: keymapgen.c
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-16
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Host tool generating the keymap.h tables from layout descriptions
+ * Usage: keymapgen <output.h> <layout> [<layout> ...]
+ *
+ * Each layout becomes a table of KEYMAP_LEN bytes, one per printable
+ * character, packing the modifiers in the two upper bits and the key in
+ * the six lower bits (see hid.h), and a bitmap flagging its dead keys.
+ * The generation fails if a character is missing, duplicated or mapped to
+ * an unknown key.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define KEYMAP_FIRST 0x20
+#define KEYMAP_LEN 95
+#define KEYMAP_DEAD_LEN ((KEYMAP_LEN + 7) / 8)
+
+// packed code format, must match hid.h
+#define KEYMAP_SHIFT 0x40
+#define KEYMAP_ALTGR 0x80
+#define KEYMAP_KEY_NONUS_BS 0x3F
+
+#define MAX_LAYOUTS 8
+
+// HID usage codes of the keys, named after their US legend
+typedef struct {
+    const char *name;
+    unsigned char usage;
+} hidkey_t;
+
+static const hidkey_t keys[] = {
+    {"a", 0x04}, {"b", 0x05}, {"c", 0x06}, {"d", 0x07}, {"e", 0x08},
+    {"f", 0x09}, {"g", 0x0A}, {"h", 0x0B}, {"i", 0x0C}, {"j", 0x0D},
+    {"k", 0x0E}, {"l", 0x0F}, {"m", 0x10}, {"n", 0x11}, {"o", 0x12},
+    {"p", 0x13}, {"q", 0x14}, {"r", 0x15}, {"s", 0x16}, {"t", 0x17},
+    {"u", 0x18}, {"v", 0x19}, {"w", 0x1A}, {"x", 0x1B}, {"y", 0x1C},
+    {"z", 0x1D}, {"1", 0x1E}, {"2", 0x1F}, {"3", 0x20}, {"4", 0x21},
+    {"5", 0x22}, {"6", 0x23}, {"7", 0x24}, {"8", 0x25}, {"9", 0x26},
+    {"0", 0x27}, {"space", 0x2C}, {"minus", 0x2D}, {"equal", 0x2E},
+    {"lbracket", 0x2F}, {"rbracket", 0x30}, {"backslash", 0x31},
+    {"nonus_hash", 0x32}, {"semicolon", 0x33}, {"quote", 0x34},
+    {"grave", 0x35}, {"comma", 0x36}, {"period", 0x37}, {"slash", 0x38},
+    {"nonus_backslash", 0x64},
+    {"none", 0x00}
+};
+
+/*
+ * Return the packed key for a key name, -1 if unknown
+ */
+static int keyCode(const char *name) {
+    unsigned int i;
+    for(i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if(strcmp(keys[i].name, name) == 0) {
+            // the six bits key field cannot hold 0x64
+            if(keys[i].usage == 0x64)
+                return KEYMAP_KEY_NONUS_BS;
+            return keys[i].usage;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Parse the character column, either the char itself or 0xNN
+ * Return -1 on error
+ */
+static int parseChar(const char *tok) {
+    char *end;
+    long c;
+
+    if(strlen(tok) == 1)
+        return (unsigned char)tok[0];
+
+    if(strncmp(tok, "0x", 2) == 0) {
+        c = strtol(tok, &end, 16);
+        if(*end == '\0')
+            return (int)c;
+    }
+    return -1;
+}
+
+/*
+ * Read a layout description into table
+ * Return the number of errors found
+ */
+static int parseLayout(const char *path, unsigned char *table, unsigned char *dead) {
+    FILE *f;
+    char line[256];
+    char *tok;
+    unsigned char defined[KEYMAP_LEN];
+    int c, key, lineNum = 0, errors = 0;
+    unsigned char code;
+
+    f = fopen(path, "r");
+    if(f == NULL) {
+        fprintf(stderr, "%s: cannot open file\n", path);
+        return 1;
+    }
+
+    memset(defined, 0, sizeof(defined));
+    memset(table, 0, KEYMAP_LEN);
+    memset(dead, 0, KEYMAP_DEAD_LEN);
+
+    while(fgets(line, sizeof(line), f) != NULL) {
+        lineNum++;
+
+        // skip comments and empty lines
+        if(strncmp(line, "//", 2) == 0)
+            continue;
+        tok = strtok(line, " \t\r\n");
+        if(tok == NULL)
+            continue;
+
+        c = parseChar(tok);
+        if(c < KEYMAP_FIRST || c >= KEYMAP_FIRST + KEYMAP_LEN) {
+            fprintf(stderr, "%s:%d: invalid character '%s'\n", path, lineNum, tok);
+            errors++;
+            continue;
+        }
+        if(defined[c - KEYMAP_FIRST]) {
+            fprintf(stderr, "%s:%d: character '%s' defined twice\n", path, lineNum, tok);
+            errors++;
+            continue;
+        }
+        defined[c - KEYMAP_FIRST] = 1;
+
+        tok = strtok(NULL, " \t\r\n");
+        key = (tok == NULL) ? -1 : keyCode(tok);
+        if(key < 0) {
+            fprintf(stderr, "%s:%d: unknown key '%s'\n", path, lineNum, tok ? tok : "");
+            errors++;
+            continue;
+        }
+        code = key;
+
+        // optional modifiers
+        while((tok = strtok(NULL, " \t\r\n")) != NULL) {
+            if(strcmp(tok, "shift") == 0)
+                code |= KEYMAP_SHIFT;
+            else if(strcmp(tok, "altgr") == 0)
+                code |= KEYMAP_ALTGR;
+            else if(strcmp(tok, "dead") == 0)
+                dead[(c - KEYMAP_FIRST) / 8] |= 1 << ((c - KEYMAP_FIRST) % 8);
+            else {
+                fprintf(stderr, "%s:%d: unknown modifier '%s'\n", path, lineNum, tok);
+                errors++;
+            }
+        }
+
+        // modifiers without a key would type nothing
+        if(key == 0)
+            code = 0;
+
+        table[c - KEYMAP_FIRST] = code;
+    }
+    fclose(f);
+
+    for(c = 0; c < KEYMAP_LEN; c++) {
+        if(!defined[c]) {
+            fprintf(stderr, "%s: character 0x%02X is not defined\n", path, c + KEYMAP_FIRST);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/*
+ * Return the layout name from its path (file name without extension)
+ */
+static void layoutName(const char *path, char *name, int len) {
+    const char *base = strrchr(path, '/');
+    int i;
+
+    base = (base == NULL) ? path : base + 1;
+    for(i = 0; i < len - 1 && base[i] != '\0' && base[i] != '.'; i++)
+        name[i] = toupper((unsigned char)base[i]);
+    name[i] = '\0';
+}
+
+int main(int argc, char **argv) {
+    unsigned char tables[MAX_LAYOUTS][KEYMAP_LEN];
+    unsigned char deadKeys[MAX_LAYOUTS][KEYMAP_DEAD_LEN];
+    char name[32];
+    int i, c, layouts, errors = 0;
+    FILE *out;
+
+    if(argc < 3 || argc - 2 > MAX_LAYOUTS) {
+        fprintf(stderr, "Usage: keymapgen <output.h> <layout> [<layout> ...]\n");
+        fprintf(stderr, "At most %d layouts are supported\n", MAX_LAYOUTS);
+        return 1;
+    }
+
+    layouts = argc - 2;
+    for(i = 0; i < layouts; i++)
+        errors += parseLayout(argv[i + 2], tables[i], deadKeys[i]);
+
+    if(errors) {
+        fprintf(stderr, "keymapgen: %d error(s), %s not generated\n", errors, argv[1]);
+        return 1;
+    }
+
+    out = fopen(argv[1], "w");
+    if(out == NULL) {
+        fprintf(stderr, "%s: cannot create file\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(out, "/*\n * Generated by layouts/keymapgen, do not edit\n */\n\n");
+    fprintf(out, "#ifndef KEYMAP_H\n#define KEYMAP_H\n\n");
+    fprintf(out, "#define KEYMAP_FIRST 0x%02X\n", KEYMAP_FIRST);
+    fprintf(out, "#define KEYMAP_LEN %d\n", KEYMAP_LEN);
+    fprintf(out, "#define KEYMAP_DEAD_LEN %d\n", KEYMAP_DEAD_LEN);
+    fprintf(out, "#define KEYMAP_LAYOUTS %d\n\n", layouts);
+
+    for(i = 0; i < layouts; i++) {
+        layoutName(argv[i + 2], name, sizeof(name));
+        fprintf(out, "#define LAYOUT_%s %d\n", name, i);
+    }
+
+    fprintf(out, "\n// packed modifier and key for each printable character\n");
+    fprintf(out, "const PROGMEM unsigned char keymap[KEYMAP_LAYOUTS][KEYMAP_LEN] = {\n");
+    for(i = 0; i < layouts; i++) {
+        layoutName(argv[i + 2], name, sizeof(name));
+        fprintf(out, "    // %s\n    {", name);
+        for(c = 0; c < KEYMAP_LEN; c++) {
+            if(c % 12 == 0)
+                fprintf(out, "%s\n        ", (c == 0) ? "" : ",");
+            else
+                fprintf(out, ", ");
+            fprintf(out, "0x%02X", tables[i][c]);
+        }
+        fprintf(out, "\n    }%s\n", (i == layouts - 1) ? "" : ",");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "// one bit per printable character set for dead keys\n");
+    fprintf(out, "const PROGMEM unsigned char keymapDead[KEYMAP_LAYOUTS][KEYMAP_DEAD_LEN] = {\n");
+    for(i = 0; i < layouts; i++) {
+        fprintf(out, "    {");
+        for(c = 0; c < KEYMAP_DEAD_LEN; c++)
+            fprintf(out, "%s0x%02X", (c == 0) ? "" : ", ", deadKeys[i][c]);
+        fprintf(out, "}%s\n", (i == layouts - 1) ? "" : ",");
+    }
+    fprintf(out, "};\n\n#endif\n");
+    fclose(out);
+
+    return 0;
+}
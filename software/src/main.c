@@ -9,6 +9,24 @@
 
 #include "main.h"
 
+/*
+ * Return the number of EEPROM requests waiting for eepromTask
+ *
+ */
+static unsigned char pendingRequests(void) {
+    return (flagClearPending != 0) + flagKeyPending + flagCredReady +
+           flagDeletePending + flagLayoutPending;
+}
+
+/*
+ * Return non zero while a store job runs or a request waits, the next
+ * request is only taken once the host sees the store idle
+ *
+ */
+static unsigned char storeBusy(void) {
+    return storeJob.job != JOB_IDLE || pendingRequests();
+}
+
 /*
  * This is called when the host send a usb_msg on control enpoint 0
  * It parses requests made by the host which can be HID related (required by spec)
@@ -17,17 +35,25 @@
 usbMsgLen_t usbFunctionSetup(unsigned char data[8]) {
     usbRequest_t *rq = (void *)data;
 
+    // a data stage only belongs to the request that asked for it, a record
+    // cut short by the host is dropped
+    recordLeft = 0;
+    readLeft = 0;
+    flagRecordFailed = 1;
+    flagReportWrite = 0;
+
     if((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS) {
         switch(rq->bRequest) {
 
             //send NO_KEYS_PRESSED
             case USBRQ_HID_GET_REPORT:
                 usbMsgPtr = (void *)&keyboard_report;
-                keyboard_report.modifier = 0;
-                keyboard_report.keycode = 0;
+                clearKeyboardReport();
                 return sizeof(keyboard_report);
 
+            // the LED report is taken and ignored
             case USBRQ_HID_SET_REPORT:
+                flagReportWrite = 1;
                 return (rq->wLength.word == 1) ? USB_NO_MSG : 0;
 
             // send idleRate to PC as per spec
@@ -45,50 +71,202 @@ usbMsgLen_t usbFunctionSetup(unsigned char data[8]) {
     else {
         switch(rq->bRequest) {
             case USB_INIT_DEVICE:
-                clearEEPROM(1);
-                idCnt = 0;
+                flagClearPending = CLEAR_RESET_KEY;
                 return USB_NO_MSG;
 
             case USB_UNLOCK_DEVICE:
                 // check if 5 failed unlock attempts occured
                 if(unlockAttempts == 5) {
-                    clearEEPROM(1);
+                    flagClearPending = CLEAR_RESET_KEY;
                     unlockAttempts = 0;
                     return 0;
                 }
                 else
                     return USB_NO_MSG;
 
-            case USB_ID_UPLOAD:
-                if(flagUnlocked)
-                    return USB_NO_MSG;
-                else
+            // the whole record in the data stage, written to EEPROM as it
+            // arrives. The data stage is stalled when the device is locked
+            // or busy or the record does not fit. A compaction making room
+            // shows in USB_GET_JOB and the record is opened once it is
+            // over. A record refused once complete shows in USB_GET_JOB too
+            case USB_WRITE_RECORD:
+                if(rq->wLength.word == 0 || rq->wLength.word > RECORD_XFER_MAX)
                     return 0;
+                recordLeft = rq->wLength.bytes[0];
+                fieldLeft = 0;
+                if(!flagUnlocked || storeBusy())
+                    return USB_NO_MSG;
+                storeJob.failed = 0;
+                flagRecordFailed = openRecord(recordLeft + 1) != 0;
+                return USB_NO_MSG;
 
-            case USB_CLEAR_EEPROM:
-                if(flagUnlocked) {
-                    clearEEPROM(0);
-                    idCnt = 0;
+            // requests changing the store are dropped while it is busy.
+            // wValue holds the layout, switched now and kept for the next
+            // boot. Returns 0 once set, 0xFF if dropped
+            case USB_SET_LAYOUT:
+                commandStatus = 0xFF;
+                if(flagUnlocked && !storeBusy() &&
+                   setKeyboardLayout(rq->wValue.bytes[0]) == 0) {
+                    layoutReceived = rq->wValue.bytes[0];
+                    flagLayoutPending = 1;
+                    commandStatus = 0;
+                }
+                usbMsgPtr = &commandStatus;
+                return 1;
+
+            // wValue holds the number of the credential to delete
+            case USB_DELETE_CRED:
+                if(flagUnlocked && !storeBusy()) {
+                    deleteReceived = rq->wValue.bytes[0];
+                    flagDeletePending = 1;
                 }
                 return 0;
+
+            case USB_CLEAR_EEPROM:
+                if(flagUnlocked && !storeBusy())
+                    flagClearPending = CLEAR_KEEP_KEY;
+                return 0;
+
+            // wValue holds the number of the credential whose idName is
+            // typed, as if the button got there. Returns 0 once shown,
+            // 0xFF if there is no such credential
+            case USB_SELECT_CRED:
+                commandStatus = 0xFF;
+                if(flagUnlocked && storeJob.job == JOB_IDLE &&
+                   rq->wValue.bytes[0] >= 1 && rq->wValue.bytes[0] <= credCount) {
+                    idCnt = rq->wValue.bytes[0];
+                    state = STATE_INIT;
+                    flagDone = 0;
+                    commandStatus = 0;
+                }
+                usbMsgPtr = &commandStatus;
+                return 1;
+
+            case USB_GET_STATUS:
+                deviceStatus.unlocked = flagUnlocked;
+                deviceStatus.credCount = credCount;
+                deviceStatus.shown = idCnt;
+                deviceStatus.layout = getKeyboardLayout();
+                deviceStatus.unlockAttempts = unlockAttempts;
+                usbMsgPtr = (void *)&deviceStatus;
+                return sizeof(deviceStatus);
+
+            // job running on the store and requests waiting for it
+            case USB_GET_JOB:
+                storeJob.pending = pendingRequests();
+                usbMsgPtr = (void *)&storeJob;
+                return sizeof(storeJob);
+
+#if STATS
+            // worst case latency and run time of each task
+            case USB_GET_STATS:
+                usbMsgPtr = (void *)schedStats;
+                return sizeof(schedStats);
+#endif
+
+            // RAM high-water mark since reset
+            case USB_GET_RAM:
+                ram_GetStats(&ramStats);
+                usbMsgPtr = (void *)&ramStats;
+                return sizeof(ramStats);
+
+#if STATS
+            // EEPROM write queue usage since reset
+            case USB_GET_QUEUE:
+                eequeue_GetStats(&queueStats);
+                usbMsgPtr = (void *)&queueStats;
+                return sizeof(queueStats);
+#endif
+
+            // EEPROM from the address in wValue, streamed by
+            // usbFunctionRead() in one long transfer. The store and its
+            // metadata are sent, the master key never is. INIT unlocks
+            // before its clear has run, the dump waits for the wipe so the
+            // records of the previous owner are never sent
+            case USB_READ_EEPROM:
+                if(!flagUnlocked || storeBusy() ||
+                   rq->wValue.word >= MASTERKEY_LOCATION)
+                    return 0;
+                readAddr = rq->wValue.word;
+                readLeft = MASTERKEY_LOCATION - readAddr;
+                if(rq->wLength.word < readLeft)
+                    readLeft = rq->wLength.word;
+                return USB_NO_MSG;
+
+            // work done mounting the store at boot
+            case USB_GET_MOUNT:
+                usbMsgPtr = (void *)&mountStats;
+                return sizeof(mountStats);
         }
     }
     return 0;
 }
 
+/*
+ * Write the next chunk of the record sent with USB_WRITE_RECORD, each
+ * field is [length][bytes] as in EEPROM
+ * Return 1 once the record is in, 0xff to stall the data stage
+ *
+ */
+static unsigned char writeRecordChunk(uint8_t *data, unsigned char len) {
+    unsigned char i;
+
+    if(flagRecordFailed)
+        return 0xff;
+
+    for(i = 0; i < len && recordLeft > 0; i++, recordLeft--) {
+        if(fieldLeft == 0)
+            fieldLeft = data[i] & FIELD_LEN_MASK;
+        else {
+            writeRecord(data[i]);
+            fieldLeft--;
+        }
+        if(fieldLeft == 0)
+            closeField();
+    }
+
+    if(recordLeft > 0)
+        return 0;
+    // added to the log by eepromTask
+    flagCredReady = 1;
+    return 1;
+}
+
+/*
+ * This function is called for each packet of a control-in transfer when
+ * usbFunctionSetup return USB_NO_MSG, the packet is read straight from
+ * EEPROM. Writes still queued are seen by eequeue_ReadBlock()
+ * Return the bytes filled, less than len ends the transfer
+ *
+ */
+unsigned char usbFunctionRead(uint8_t *data, unsigned char len) {
+    if(len > readLeft)
+        len = readLeft;
+    eequeue_ReadBlock(data, (const void *)readAddr, len);
+    readAddr += len;
+    readLeft -= len;
+    return len;
+}
+
 /*
  * This function is called when usbFunctionSetup return USB_NO_MSG
  * We can only receive chunks of 8 bytes so the state value
- * is stored in the first byte of the data buffer
+ * is stored in the first byte of the data buffer, records are streamed
+ * without it
  *
  */
-usbMsgLen_t usbFunctionWrite(uint8_t * data, unsigned char len) {
-    unsigned char i;
+unsigned char usbFunctionWrite(uint8_t * data, unsigned char len) {
+    if(flagReportWrite)
+        return 1;
+    if(recordLeft > 0)
+        return writeRecordChunk(data, len);
+
     idState = data[0];
     switch(idState) {
         case STATE_INIT_DEVICE:
-            // memory has been wiped now we write master key to it
-            setMasterKey((char *)&data[1]);
+            // the key is written once the memory has been wiped
+            memcpy(masterKey, &data[1], MASTERKEY_LEN);
+            flagKeyPending = 1;
             flagUnlocked = 1;
             LED_LOW();
             return 1;
@@ -104,72 +282,296 @@ usbMsgLen_t usbFunctionWrite(uint8_t * data, unsigned char len) {
             else
                 unlockAttempts++;
             return 1;
+    }
 
-        case STATE_ID_UPLOAD_INIT:
-            // clear credentials structure and reset msg pointer
-            clearCred(&credReceived);
-            idMsgPtr = 0;
-            return 1;
+    return 1;
+}
 
-        case STATE_ID_NAME_SEND:
-            for(i = 1; i < len; i++) {
-                credReceived.idName[idMsgPtr] = data[i];
-                idMsgPtr++;
-            }
-            return 1;
+/*
+ * Task keeping the USB connection alive
+ * It runs on every pass of the scheduler, its latency is the time
+ * usbPoll() waited for the other tasks
+ *
+ */
+static void usbTask(void) {
+    wdt_reset();
+    usbPoll();
+}
 
-        case STATE_ID_NAME_DONE:
-            idMsgPtr = 0;
-            return 1;
+/*
+ * Task turning pushbutton events into actions
+ *
+ */
+static void buttonTask(void) {
+    unsigned char event;
+
+    button_Poll();
+    event = button_GetEvent();
+
+    // only if device is unlocked and holds credentials, records move while
+    // a job runs
+    if(flagUnlocked != 1 || credCount == 0 || storeJob.job != JOB_IDLE)
+        return;
+
+    switch(event) {
+        // short PB press shows the next idName
+        case BUTTON_SHORT:
+            if(idCnt < credCount)
+                idCnt++;
+            else
+                idCnt = 1;
+            state = STATE_INIT;
+            flagDone = 0;
+            break;
+
+        // double PB press goes back to the previous idName
+        case BUTTON_DOUBLE:
+            if(idCnt > 1)
+                idCnt--;
+            else
+                idCnt = credCount;
+            state = STATE_INIT;
+            flagDone = 0;
+            break;
+
+        // long PB press injects the credential of the shown idName
+        case BUTTON_LONG:
+            state = STATE_LONG_KEY;
+            flagDone = 0;
+            break;
+    }
+}
 
-        case STATE_ID_USERNAME_SEND:
-            for(i = 1; i < len; i++) {
-                credReceived.idUsername[idMsgPtr] = data[i];
-                idMsgPtr++;
-            }
-            return 1;
+/*
+ * Build the next report typing the field under the cursor and move it
+ * past the characters typed. Only the few characters one report can hold
+ * are read from EEPROM
+ * Return the number of characters typed
+ *
+ */
+static unsigned char typeField(field_cursor_t *cur) {
+    char window[INJECT_KEYS_PER_REPORT + 1];
+    field_cursor_t ahead = *cur;
+    unsigned char i, runLen;
+
+    for(i = 0; i < INJECT_KEYS_PER_REPORT; i++)
+        window[i] = readField(&ahead);
+    window[INJECT_KEYS_PER_REPORT] = '\0';
+
+    runLen = buildReportRun(window, INJECT_KEYS_PER_REPORT);
+    skipField(cur, runLen);
+    return runLen;
+}
 
-        case STATE_ID_USERNAME_DONE:
-            idMsgPtr = 0;
-            return 1;
+/*
+ * Return the number of leading characters the idName of idNum shares with
+ * the first len characters of the idName of shownId
+ *
+ */
+static unsigned char namePrefix(unsigned char idNum, unsigned char len) {
+    field_cursor_t shown, next;
+    unsigned char i = 0;
+
+    openField(&shown, shownId, FIELD_NAME);
+    openField(&field, idNum, FIELD_NAME);
+    next = field;
+
+    while(i < len && readField(&shown) == readField(&next))
+        i++;
+    return i;
+}
 
-        case STATE_ID_PASS_SEND:
-            for(i = 1; i < len; i++) {
-                credReceived.idPassword[idMsgPtr] = data[i];
-                idMsgPtr++;
+/*
+ * Task pacing the injection, one report each time the interrupt
+ * endpoint is free
+ *
+ */
+static void injectTask(void) {
+    if(flagUnlocked != 1 || !usbInterruptIsReady() || state == STATE_WAIT || flagDone)
+        return;
+
+    switch(state) {
+        case STATE_INIT:
+            // keep the leading characters shared with the idName on screen
+            keepLen = namePrefix(idCnt, matchLen);
+            matchLen = keepLen;
+            shownId = idCnt;
+            skipField(&field, keepLen);
+            state = STATE_SEND_ID_NAME;
+            flagKeyCleared = 0;
+
+        case STATE_SEND_ID_NAME:
+            // erase what differs, the encoder releases between backspaces
+            if(!flagKeyCleared && typedLen > keepLen) {
+                typedLen -= buildReportRun(keyBackspace, 1);
+                break;
             }
-            return 1;
+            flagKeyCleared = 1;
+
+            typedLen += typeField(&field);
+            matchLen = typedLen;
+
+            // release the keys once the whole idName is typed
+            if(peekField(&field) == '\0')
+                state = STATE_RELEASE_ID_NAME;
+            break;
+
+        case STATE_RELEASE_ID_NAME:
+            // always send empty report when done sending the idName
+            buildReport(0);
+            flagDone = 1;
+            flagKeyCleared = 0;
+            state = STATE_WAIT;
+            break;
+
+        case STATE_LONG_KEY:
+            openField(&field, idCnt, FIELD_USERNAME);
+            keepLen = 0;
+            matchLen = 0;
+            flagKeyCleared = 0;
+            state = STATE_SEND_ID_USERNAME;
+
+        case STATE_SEND_ID_USERNAME:
+            // clear the previous idName
+            if(!flagKeyCleared && typedLen > keepLen) {
+                typedLen -= buildReportRun(keyBackspace, 1);
+                break;
+            }
+            flagKeyCleared = 1;
+
+            typedLen += typeField(&field);
+
+            // the TAB key follows without releasing the last keys
+            if(peekField(&field) == '\0')
+                state = STATE_SEND_TAB;
+            break;
+
+        case STATE_SEND_TAB:
+            // send tab character
+            if(buildReportRun(keyTab, 1)) {
+                // the focus left the field holding the typed characters
+                typedLen = 0;
+                openField(&field, idCnt, FIELD_PASSWORD);
+                state = STATE_SEND_ID_PASSWORD;
+            }
+            break;
+
+        case STATE_SEND_ID_PASSWORD:
+            // erased by the next idName shown, matchLen stays 0 so none
+            // of it is kept
+            typedLen += typeField(&field);
+
+            // we are done injecting data
+            if(peekField(&field) == '\0')
+                state = STATE_RELEASE_ID_PASSWORD;
+            break;
+
+        case STATE_RELEASE_ID_PASSWORD:
+            // always send empty report when done injecting
+            buildReport(0);
+            flagDone = 1;
+            state = STATE_WAIT;
+            break;
+
+        // should not happen
+        default:
+            state = STATE_WAIT;
+    }
 
-        case STATE_ID_PASS_DONE:
-            flagCredReady = 1;
-            update_credential(credReceived);
-            return 1;
+    usbSetInterrupt((void *)&keyboard_report, sizeof(keyboard_report));
+    LED_TOGGLE();
+}
+
+/*
+ * Task running the EEPROM work requested from the USB callbacks
+ * Writes take 3.4ms per byte so they are kept out of usbFunctionSetup and
+ * usbFunctionWrite, they are queued and programmed by the EEPROM ready
+ * interrupt meanwhile. It runs on every pass right after usbTask so a request
+ * is always started before the next USB message is handled. Compactions
+ * and the wipe after a clear run as store jobs a step per pass, requests
+ * wait for them
+ *
+ */
+static void eepromTask(void) {
+    // the job moves or rewrites the records being typed
+    if(storeJob.job != JOB_IDLE) {
+        if(state == STATE_WAIT)
+            storeJobStep();
+        return;
     }
 
-    return 1;
+    if(flagClearPending) {
+        clearEEPROM(flagClearPending == CLEAR_RESET_KEY);
+        flagClearPending = 0;
+        idCnt = 0;
+        // the idName on screen is no longer in EEPROM
+        matchLen = 0;
+    }
+
+    if(flagKeyPending) {
+        // memory has been wiped now we write master key to it
+        setMasterKey(&masterKey[0]);
+        flagKeyPending = 0;
+    }
+
+    if(flagCredReady) {
+        // the host sees a record refused once complete in USB_GET_JOB
+        storeJob.failed = (closeRecord() != 0);
+        flagCredReady = 0;
+        // records may have been replaced
+        matchLen = 0;
+    }
+
+    if(flagDeletePending) {
+        if(deleteCredential(deleteReceived) == 0 && idCnt > credCount)
+            idCnt = credCount;
+        flagDeletePending = 0;
+        matchLen = 0;
+    }
+
+    if(flagLayoutPending) {
+        setLayout(layoutReceived);
+        // the idName on screen was typed with the old layout
+        matchLen = 0;
+        flagLayoutPending = 0;
+    }
 }
 
+// tasks in priority order, usbTask first
+static task_t tasks[SCHED_TASK_COUNT] = {
+    // run, period ms, latency budget ms
+    {usbTask, 0, 10},
+    {eepromTask, 0, 50},
+    {injectTask, 1, 10},
+    {buttonTask, 5, 20}
+};
+
 int main() {
     // variables declaration
     unsigned char i;
-    cred_t cred;
 
     // Modules initialization
     LED_Init();
     timer1_Init();
-    PB_INIT();
+    button_Init();
     LED_HIGH();
 
     // variables init
     clearKeyboardReport();
-    clearCred(&cred);
+
+    // mount the credential store, the timer runs meanwhile to measure the
+    // recovery after a power loss. USB is not started yet
+    sei();
+    mountStats.time = timer1_Now();
+    mountStore(&mountStats);
+    mountStats.time = timer1_Now() - mountStats.time;
+    idCnt = credCount;
 
     // global interrupts off
     cli();
 
-    // get number of credentials in EEPROM
-    getCredCount();
-    idCnt = credCount;
+    // cache the keyboard layout, unknown values keep the US layout
+    setKeyboardLayout(getLayout());
 
     // initialize usb library
     usbInit();
@@ -193,186 +595,8 @@ int main() {
     // Enable global interrupts after re-enumeration
     sei();
 
-    while(1) {
-        wdt_reset();
-        usbPoll();
-
-        // only if device is unlocked
-        if(flagUnlocked == 1) {
-            // PB press detection
-            if(!(PINB & (1<<PB3))) {
-                // debouncing
-                if(state == STATE_WAIT && pbCounter == 255) {
-                    // short PB press
-                    state = STATE_INIT;
-                    flagDone = 0;// reset counter
-
-                    // iterate to next idCnt
-                    if(idCnt < credCount) {
-                        idCnt++;
-                    }
-                    else
-                        idCnt = 1;
-
-                    counter100ms = 0;
-
-                    while(!(PINB & (1<<PB3)) && !pbHold) {
-                        // waiting for PB long press event
-                        wdt_reset();
-                        // if PB is held for 1.0s
-                        if(counter100ms >= 10) {
-                            counter100ms = 0;
-                            state = STATE_LONG_KEY;
-                            // send idUsername
-                            pbHold = 1;
-                            flagDone = 0;
-                        }
-                    }
-                }
-                pbHold = 0;
-                pbCounter = 0;
-            }
-            // debouncing
-            if(pbCounter < 255)
-                pbCounter++;
-
-            if(usbInterruptIsReady() && state != STATE_WAIT && !flagDone) {
-                unsigned char sendKey;
-                switch(state) {
-                    case STATE_INIT:
-                        clearCred(&cred);
-                        getCredentialData(idCnt, &cred);
-                        credPtr = 0;
-                        state = STATE_SEND_ID_NAME;
-                        flagKeyCleared = 0;
-
-                    case STATE_SEND_ID_NAME:
-                        sendKey = cred.idName[credPtr];
-                        if(flagKeyCleared) {
-                            buildReport(sendKey);
-                        }
-
-                        else {
-                                if(clearKeyCnt == 10) {
-                                clearKeyCnt = 0;
-                                flagKeyCleared = 1;
-                                buildReport(sendKey);
-                            }
-
-                            else {
-                                buildReport(KEY_BS);
-                                clearKeyCnt++;
-                            }
-                        }
-                        state = STATE_RELEASE_ID_NAME;
-                        break;
-
-                    case STATE_RELEASE_ID_NAME:
-                        // always send empty report when done sending a key
-                        buildReport(0);
-
-                        // upgrade credPtr only if we are not sending backspace key
-                        if(flagKeyCleared)
-                            credPtr++;
-
-                        // if the next char is NULL
-                        if(cred.idName[credPtr] == '\0') {
-                            flagDone = 1;
-                            credPtr = 0;
-                            flagKeyCleared = 0;
-                            state = STATE_WAIT;
-                        }
-                        // the next char is valid so we go back to state_short_key
-                        else {
-                            state = STATE_SEND_ID_NAME;
-                        }
-                        break;
-
-                    case STATE_LONG_KEY:
-                        credPtr = 0;
-                        flagKeyCleared = 0;
-                        state = STATE_SEND_ID_USERNAME;
-
-                    case STATE_SEND_ID_USERNAME:
-                        sendKey = cred.idUsername[credPtr];
-                        // clear the previous idName
-                        if(flagKeyCleared)
-                            buildReport(sendKey);
-                        else {
-                            if(clearKeyCnt == 10) {
-                                clearKeyCnt = 0;
-                                flagKeyCleared = 1;
-                                buildReport(sendKey);
-                            }
-
-                            else {
-                                buildReport(KEY_BS);
-                                clearKeyCnt++;
-                            }
-                        }
-
-                        state = STATE_RELEASE_ID_USERNAME;
-                        break;
-
-                    case STATE_RELEASE_ID_USERNAME:
-                        // always send empty report when done sending a key
-                        buildReport(0);
-                        if(flagKeyCleared)
-                            credPtr++;
-
-                        // if the next char is NULL
-                        if(cred.idUsername[credPtr] == '\0') {
-                            state = STATE_SEND_TAB;
-                        }
-                        // the next char is valid so we go back to state_short_key
-                        else {
-                            state = STATE_SEND_ID_USERNAME;
-                        }
-                        break;
-
-                    case STATE_SEND_TAB:
-                        // send tab character
-                        buildReport(KEY_TAB);
-                        state = STATE_RELEASE_TAB;
-                        break;
-
-                    case STATE_RELEASE_TAB:
-                        buildReport(0);
-                        credPtr = 0;
-                        state = STATE_SEND_ID_PASSWORD;
-                        break;
-
-                    case STATE_SEND_ID_PASSWORD:
-                        sendKey = cred.idPassword[credPtr];
-                        buildReport(sendKey);
-                        state = STATE_RELEASE_ID_PASSWORD;
-                        break;
-
-                    case STATE_RELEASE_ID_PASSWORD:
-                        // always send empty report when done sending a key
-                        buildReport(0);
-                        credPtr++;
-
-                        // we are done injecting data
-                        if(cred.idPassword[credPtr] == '\0') {
-                            flagDone = 1;
-                            state = STATE_WAIT;
-                        }
-                        // the next char is valid so we go back to state_short_key
-                        else {
-                            state = STATE_SEND_ID_PASSWORD;
-                        }
-                        break;
-
-                    // should not happen
-                    default:
-                        state = STATE_WAIT;
-                }
+    // never returns
+    sched_Run(tasks, schedStats, SCHED_TASK_COUNT);
 
-                usbSetInterrupt((void *)&keyboard_report, sizeof(keyboard_report));
-                LED_TOGGLE();
-            }
-        }
-    }
     return 0;
 }
@@ -11,13 +11,16 @@
 #include <util/delay.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
-#include <avr/eeprom.h>
 
 #include "usbdrv.h"
 #include "credentials.h"
 #include "led.h"
 #include "hid.h"
 #include "timer1.h"
+#include "button.h"
+#include "sched.h"
+#include "ram.h"
+#include "eequeue.h"
 
 // states for id cycling and injection
 #define STATE_WAIT 0
@@ -26,9 +29,7 @@
 #define STATE_RELEASE_ID_NAME 3
 #define STATE_LONG_KEY 4
 #define STATE_SEND_ID_USERNAME 5
-#define STATE_RELEASE_ID_USERNAME 6
 #define STATE_SEND_TAB 7
-#define STATE_RELEASE_TAB 8
 #define STATE_SEND_ID_PASSWORD 9
 #define STATE_RELEASE_ID_PASSWORD 10
 
@@ -36,45 +37,102 @@
 #define USB_LED_OFF 0
 #define USB_LED_ON 1
 #define USB_CLEAR_EEPROM 2
-#define USB_ID_UPLOAD 3
 #define USB_UNLOCK_DEVICE 15
 #define USB_INIT_DEVICE 16
+#define USB_SET_LAYOUT 17
+#define USB_GET_STATS 18
+#define USB_GET_RAM 19
+#define USB_DELETE_CRED 20
+#define USB_GET_MOUNT 21
+#define USB_GET_JOB 22
+#define USB_GET_QUEUE 23
+#define USB_WRITE_RECORD 24
+#define USB_SELECT_CRED 27
+#define USB_GET_STATUS 28
+#define USB_READ_EEPROM 29
 
 // states for usbFunctionWrite
-#define STATE_ID_UPLOAD_INIT 4
-#define STATE_ID_NAME_SEND 5
-#define STATE_ID_NAME_DONE 6
-#define STATE_ID_USERNAME_SEND 7
-#define STATE_ID_USERNAME_DONE 8
-#define STATE_ID_PASS_SEND 9
-#define STATE_ID_PASS_DONE 10
-#define STATE_ID_UPLOAD_DONE 11
 #define STATE_UNLOCK_DEVICE 12
 #define STATE_INIT_DEVICE 13
 
+// values of flagClearPending
+#define CLEAR_KEEP_KEY 1
+#define CLEAR_RESET_KEY 2
+
+// longest data stage of USB_WRITE_RECORD, records the log cannot hold are
+// cut by writeRecord()
+#define RECORD_XFER_MAX 254
+
+// number of tasks run by the scheduler
+#define SCHED_TASK_COUNT 4
+
+// state of the device returned by USB_GET_STATUS
+typedef struct {
+    unsigned char unlocked;
+    unsigned char credCount;
+    unsigned char shown;            // idName shown, 0 for none
+    unsigned char layout;
+    unsigned char unlockAttempts;
+} device_status_t;
+
 // ASCII key codes for BS and TAB keys
 #define KEY_BS  0x08
 #define KEY_TAB 0x09
 
+// max characters packed in one report during injection (1 disables rollover)
+#define INJECT_KEYS_PER_REPORT 6
+
 // init
-static unsigned char pbCounter = 0;
-static unsigned char pbHold = 0;
 static unsigned char state = STATE_WAIT;
 static unsigned char flagDone = 0;
 static unsigned char flagCredReady = 0;
+static unsigned char flagClearPending = 0;
+static unsigned char flagKeyPending = 0;
+static unsigned char flagLayoutPending = 0;
+static unsigned char layoutReceived;
+static unsigned char flagDeletePending = 0;
+// EEPROM streamed by usbFunctionRead(), next address and bytes left
+static unsigned int readAddr;
+static unsigned int readLeft = 0;
+// answer of the commands taking their argument in wValue
+static unsigned char commandStatus;
+static unsigned char deleteReceived;
 static unsigned char flagKeyCleared = 1;
 static unsigned char flagUnlocked = 0;
-static unsigned char idMsgPtr = 0;
 static unsigned char idState;
-static unsigned char clearKeyCnt = 0;
+// record sent with USB_WRITE_RECORD, bytes still to come and left in the
+// field received
+static unsigned char recordLeft = 0;
+static unsigned char fieldLeft;
+static unsigned char flagRecordFailed;
+// data stage of a HID SET_REPORT, never a command
+static unsigned char flagReportWrite = 0;
+// characters typed by the device in the focused field
+static unsigned char typedLen = 0;
+// leading typed characters known to match the idName of shownId
+static unsigned char matchLen = 0;
+static unsigned char shownId = 0;
+// typed characters kept when erasing before the next field
+static unsigned char keepLen = 0;
 static unsigned char idCnt = 0;
-static unsigned char credPtr = 0;
 static unsigned char unlockAttempts = 0;
 static unsigned char idleRate;
 static char masterKey[7];
 
+// strings typed by the encoder for single keys
+static const char keyBackspace[] = {KEY_BS, '\0'};
+static const char keyTab[] = {KEY_TAB, '\0'};
+
 // global structs
-cred_t credReceived;
+// field being injected, read from EEPROM
+static field_cursor_t field;
+static sched_stats_t schedStats[SCHED_TASK_COUNT];
+static ram_stats_t ramStats;
+#if STATS
+static eequeue_stats_t queueStats;
+#endif
+static mount_stats_t mountStats;
+static device_status_t deviceStatus;
 keyboard_report_t keyboard_report;
 
 // hid descriptor stored in flash
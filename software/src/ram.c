@@ -0,0 +1,54 @@
+/*
+ * File: ram.c
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ */
+
+#include <avr/io.h>
+#include "ram.h"
+
+// first byte after .bss, set by the linker
+extern unsigned char _end;
+
+/*
+ * Paint the RAM between the end of .bss and RAMEND with RAM_CANARY
+ * This runs from .init1, before the stack pointer and r1 are set up, so
+ * it is written in assembly and must not be called
+ *
+ */
+void ram_Paint(void) __attribute__((naked, used, section(".init1")));
+void ram_Paint(void) {
+    __asm__ volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(%1)\n"
+        "1:  st Z+, r24\n"
+        "    cpi r30, lo8(%1)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :
+        : "i" (RAM_CANARY), "i" (RAMEND)
+    );
+}
+
+/*
+ * Measure the RAM used since reset
+ * The stack grows down from RAMEND, bytes above .bss still holding the
+ * canary were never reached
+ *
+ */
+void ram_GetStats(ram_stats_t *stats) {
+    const unsigned char *p = &_end;
+
+    while(p <= (const unsigned char *)RAMEND && *p == RAM_CANARY)
+        p++;
+
+    stats->data = (unsigned int)&_end - RAMSTART;
+    stats->unused = (unsigned int)(p - &_end);
+    stats->stack = RAMEND + 1 - (unsigned int)p;
+}
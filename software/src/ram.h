@@ -0,0 +1,26 @@
+/*
+ * File: ram.h
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ */
+
+#ifndef RAM_H
+#define RAM_H
+
+// value painted over the free RAM at reset, the stack overwrites it
+#define RAM_CANARY 0xC5
+
+// RAM usage in bytes, sent to the host as is (little endian)
+typedef struct {
+    unsigned int data;      // .data and .bss
+    unsigned int stack;     // deepest stack reached since reset
+    unsigned int unused;    // bytes never touched since reset
+} ram_stats_t;
+
+// prototypes
+void ram_GetStats(ram_stats_t *stats);
+
+#endif
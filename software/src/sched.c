@@ -0,0 +1,87 @@
+/*
+ * File: sched.c
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Cooperative run to completion scheduler
+ * Tasks are checked in table order on every pass and run when their
+ * deadline is reached. The latency of a task is how late it started
+ * after its deadline, for tasks with period 0 it is the time since their
+ * previous run ended, i.e. how long the other tasks kept them waiting.
+ * The statistics are only kept in builds with STATS set.
+ */
+
+#include "sched.h"
+#include "timer1.h"
+
+#if STATS
+/*
+ * Clamp a duration in ms to the 8 bits of the statistics
+ *
+ */
+static unsigned char saturate(unsigned int ms) {
+    return (ms > 255) ? 255 : ms;
+}
+#endif
+
+/*
+ * Run the tasks forever
+ *
+ */
+void sched_Run(task_t *tasks, sched_stats_t *stats, unsigned char count) {
+    unsigned char i;
+    unsigned int start;
+    task_t *task;
+#if STATS
+    unsigned char latency, runTime;
+#endif
+
+    // every task is due right away
+    start = timer1_Now();
+    for(i = 0; i < count; i++) {
+        tasks[i].next = start;
+#if STATS
+        stats[i].maxLatency = 0;
+        stats[i].maxRun = 0;
+        stats[i].overruns = 0;
+#endif
+    }
+
+    while(1) {
+        for(i = 0; i < count; i++) {
+            task = &tasks[i];
+            start = timer1_Now();
+
+            // not due yet, the difference handles the tick wrap
+            if(task->period && (int)(start - task->next) < 0)
+                continue;
+
+#if STATS
+            latency = saturate(start - task->next);
+            task->run();
+            runTime = saturate(timer1_Now() - start);
+
+            if(latency > stats[i].maxLatency)
+                stats[i].maxLatency = latency;
+            if(runTime > stats[i].maxRun)
+                stats[i].maxRun = runTime;
+            if(latency > task->budget && stats[i].overruns < 255)
+                stats[i].overruns++;
+#else
+            task->run();
+#endif
+
+            if(task->period == 0) {
+                task->next = timer1_Now();
+            }
+            else {
+                task->next += task->period;
+                // skip the periods missed instead of running in a burst
+                if((int)(start - task->next) >= 0)
+                    task->next = start + task->period;
+            }
+        }
+    }
+}
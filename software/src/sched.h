@@ -0,0 +1,31 @@
+/*
+ * File: sched.h
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+// task run by the scheduler, period 0 runs it on every pass
+typedef struct {
+    void (*run)(void);
+    unsigned char period;
+    unsigned char budget;
+    unsigned int next;
+} task_t;
+
+// worst case timings of a task in ms, saturating at 255
+typedef struct {
+    unsigned char maxLatency;
+    unsigned char maxRun;
+    unsigned char overruns;
+} sched_stats_t;
+
+// prototypes
+void sched_Run(task_t *tasks, sched_stats_t *stats, unsigned char count);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * File: io.h
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Host stand-in for avr-libc used by the wear simulator, only the port
+ * driving the LED exists
+ */
+
+#ifndef SIM_IO_H
+#define SIM_IO_H
+
+#include <stdint.h>
+
+extern uint8_t simPortB;
+#define PORTB simPortB
+
+#endif
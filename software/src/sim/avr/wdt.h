@@ -0,0 +1,17 @@
+/*
+ * File: wdt.h
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Host stand-in for avr-libc used by the wear simulator, there is no
+ * watchdog
+ */
+
+#ifndef SIM_WDT_H
+#define SIM_WDT_H
+
+#define wdt_reset()
+
+#endif
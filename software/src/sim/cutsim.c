@@ -0,0 +1,305 @@
+/*
+ * File: cutsim.c
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Host tool running the credential store of the firmware (credentials.c)
+ * on a simulated EEPROM and losing the power in the middle of store
+ * operations
+ * Usage: cutsim
+ *
+ * Each scenario fills a store and runs its operation once to count the
+ * EEPROM writes it makes. The operation is then run again from the same
+ * EEPROM once per write, the power being lost right before that write.
+ * The device is plugged in again like main() does and must show the
+ * credentials as they were before the operation or as they are once it is
+ * over, in the same order. The job started by the mount must leave them
+ * so, a second mount must find nothing to recover and a credential sent
+ * then must be stored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include "eequeue.h"
+#include "credentials.h"
+#include "hid.h"
+
+#define EEPROM_SIZE 512
+
+// longest credential read back as text, tab separated
+#define ROW_LEN (ID_NAME_LEN + ID_USERNAME_LEN + ID_PASSWORD_LEN + 3)
+
+// state of the simulated hardware
+static uint8_t eeprom[EEPROM_SIZE];
+static unsigned long writes = 0;
+// writes left before the power is lost, none when negative
+static long writesLeft = -1;
+static jmp_buf powerLoss;
+uint8_t simPortB;
+keyboard_report_t keyboard_report;
+
+// a store operation and the credentials it starts from
+typedef struct {
+    const char *name;
+    void (*fill)(void);
+    void (*run)(void);
+} scenario_t;
+
+// the EEPROM write queue of the firmware once drained
+uint8_t eequeue_ReadByte(const uint8_t *addr) {
+    return eeprom[(uintptr_t)addr % EEPROM_SIZE];
+}
+
+// the power is lost before the byte changes, bytes left as they are
+// cost no write
+void eequeue_UpdateByte(uint8_t *addr, uint8_t value) {
+    uintptr_t i = (uintptr_t)addr % EEPROM_SIZE;
+
+    if(eeprom[i] == value)
+        return;
+    if(writesLeft == 0)
+        longjmp(powerLoss, 1);
+    if(writesLeft > 0)
+        writesLeft--;
+    eeprom[i] = value;
+    writes++;
+}
+
+void eequeue_ReadBlock(void *dst, const void *src, size_t n) {
+    size_t i;
+    for(i = 0; i < n; i++)
+        ((uint8_t *)dst)[i] = eequeue_ReadByte((const uint8_t *)src + i);
+}
+
+void eequeue_UpdateBlock(const void *src, void *dst, size_t n) {
+    size_t i;
+    for(i = 0; i < n; i++)
+        eequeue_UpdateByte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+/*
+ * Run the job started by the last request to its end, like eepromTask
+ */
+static void runJob(void) {
+    while(storeJobStep());
+}
+
+/*
+ * Plug the device in like main(): mount the store and type with the
+ * layout it keeps. The job started by the mount is left to the caller
+ * Return the work redone by the mount
+ */
+static unsigned char plug(void) {
+    mount_stats_t stats;
+
+    mountStore(&stats);
+    setKeyboardLayout(getLayout());
+    return stats.recovered;
+}
+
+/*
+ * Send a record with its text fields like USB_WRITE_RECORD does
+ * Return the result of closeRecord(), -1 if the log had no room
+ */
+static int sendRecord(const char *fields[FIELD_COUNT]) {
+    unsigned char i, size = 1 + FIELD_COUNT;
+    const char *c;
+    int ret;
+
+    for(i = 0; i < FIELD_COUNT; i++)
+        size += strlen(fields[i]);
+
+    while((ret = openRecord(size)) == STORE_BUSY)
+        runJob();
+    if(ret != 0)
+        return ret;
+
+    for(i = 0; i < FIELD_COUNT; i++) {
+        for(c = fields[i]; *c != '\0'; c++)
+            writeRecord(*c);
+        closeField();
+    }
+    return closeRecord();
+}
+
+/*
+ * Send the credential name, username, password
+ * Return as sendRecord()
+ */
+static int sendCred(const char *name, const char *username, const char *password) {
+    const char *fields[FIELD_COUNT] = {name, username, password};
+
+    return sendRecord(fields);
+}
+
+/*
+ * Read the credentials shown by the device as text in their order
+ * Return their number
+ */
+static unsigned char readStore(char rows[CRED_MAX][ROW_LEN]) {
+    field_cursor_t cur;
+    unsigned char idNum, field, len;
+    char c;
+
+    for(idNum = 1; idNum <= credCount; idNum++) {
+        len = 0;
+        for(field = 0; field < FIELD_COUNT; field++) {
+            openField(&cur, idNum, field);
+            while((c = readField(&cur)) != '\0' && len < ROW_LEN - 2)
+                rows[idNum - 1][len++] = c;
+            rows[idNum - 1][len++] = '\t';
+        }
+        rows[idNum - 1][len - 1] = '\0';
+    }
+    return credCount;
+}
+
+/*
+ * Return 1 if both stores hold the same credentials in the same order
+ */
+static int sameStores(char a[CRED_MAX][ROW_LEN], unsigned char na,
+                      char b[CRED_MAX][ROW_LEN], unsigned char nb) {
+    unsigned char i;
+
+    if(na != nb)
+        return 0;
+
+    for(i = 0; i < na && strcmp(a[i], b[i]) == 0; i++);
+    return i == na;
+}
+
+/*
+ * 10 short credentials, every third one replaced so the log holds
+ * tombstones
+ */
+static void fillShort(void) {
+    char name[ID_NAME_LEN + 1], username[ID_USERNAME_LEN + 1];
+    unsigned char i;
+
+    for(i = 0; i < 10; i++) {
+        snprintf(name, sizeof(name), "s%02u", i);
+        snprintf(username, sizeof(username), "user%02u@example.org", i);
+        sendCred(name, username, "pw");
+    }
+    for(i = 0; i < 10; i += 3) {
+        snprintf(name, sizeof(name), "s%02u", i);
+        snprintf(username, sizeof(username), "new%02u@example.org", i);
+        sendCred(name, username, "pw2");
+    }
+}
+
+/*
+ * Replace a credential with a longer one, the log is compacted first
+ */
+static void runUpdate(void) {
+    sendCred("s07", "averylongusername@example.org", "anotherlongpassword");
+}
+
+/*
+ * Delete a credential
+ */
+static void runDelete(void) {
+    deleteCredential(3);
+    runJob();
+}
+
+/*
+ * Change the layout like USB_SET_LAYOUT, it goes to the metadata ring
+ */
+static void runLayout(void) {
+    setKeyboardLayout(2);
+    setLayout(2);
+}
+
+static const scenario_t scenarios[] = {
+    {"update", fillShort, runUpdate},
+    {"delete", fillShort, runDelete},
+    {"layout", fillShort, runLayout}
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/*
+ * Cut the power at every write of the operation of scenario
+ * Return the number of cuts the store did not survive
+ */
+static unsigned int runScenario(const scenario_t *scenario) {
+    static uint8_t start[EEPROM_SIZE];
+    static char before[CRED_MAX][ROW_LEN], after[CRED_MAX][ROW_LEN], now[CRED_MAX][ROW_LEN];
+    unsigned char nBefore, nAfter, n;
+    unsigned long cut, total;
+    unsigned int failed = 0;
+    int same;
+
+    // a new device, initialized and filled
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    plug();
+    clearEEPROM(1);
+    runJob();
+    scenario->fill();
+    plug();
+    runJob();
+    memcpy(start, eeprom, sizeof(start));
+    nBefore = readStore(before);
+
+    writes = 0;
+    scenario->run();
+    runJob();
+    total = writes;
+    plug();
+    nAfter = readStore(after);
+
+    for(cut = 0; cut < total; cut++) {
+        memcpy(eeprom, start, sizeof(eeprom));
+        plug();
+        runJob();
+
+        writesLeft = cut;
+        if(!setjmp(powerLoss))
+            scenario->run();
+        writesLeft = -1;
+
+        // the credentials must show right after the mount and once the
+        // work it started is over
+        plug();
+        n = readStore(now);
+        same = sameStores(now, n, before, nBefore) || sameStores(now, n, after, nAfter);
+        if(same) {
+            runJob();
+            n = readStore(now);
+            same = sameStores(now, n, before, nBefore) || sameStores(now, n, after, nAfter);
+        }
+
+        if(!same)
+            fprintf(stderr, "%s: cut before write %lu shows other credentials\n", scenario->name, cut);
+        else if(plug())
+            fprintf(stderr, "%s: cut before write %lu recovered twice\n", scenario->name, cut);
+        else if(sendCred("zz", "a", "b") != 0)
+            fprintf(stderr, "%s: cut before write %lu refuses new credentials\n", scenario->name, cut);
+        else
+            continue;
+        failed++;
+    }
+
+    printf("%-8s %6lu %8u\n", scenario->name, total, failed);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    unsigned int i, failed = 0;
+
+    if(argc > 1) {
+        fprintf(stderr, "Usage: cutsim\n");
+        return 1;
+    }
+
+    printf("scenario  writes  failed\n");
+    for(i = 0; i < SCENARIO_COUNT; i++)
+        failed += runScenario(&scenarios[i]);
+
+    return failed != 0;
+}
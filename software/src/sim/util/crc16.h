@@ -0,0 +1,26 @@
+/*
+ * File: crc16.h
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Host stand-in for avr-libc used by the wear simulator, same CRC-8 as the
+ * avr-libc version (polynomial x^8 + x^5 + x^4 + 1, reflected)
+ */
+
+#ifndef SIM_CRC16_H
+#define SIM_CRC16_H
+
+#include <stdint.h>
+
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data) {
+    uint8_t i;
+
+    crc ^= data;
+    for(i = 0; i < 8; i++)
+        crc = (crc & 0x01) ? (crc >> 1) ^ 0x8C : (crc >> 1);
+    return crc;
+}
+
+#endif
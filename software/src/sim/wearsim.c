@@ -0,0 +1,315 @@
+/*
+ * File: wearsim.c
+ * Project: StickPass
+ * Author: Alexandru Jora (alexandru@jora.ca)
+ * Creation Date: 2026-10-17
+ * License: GNU GPL v3 (see LICENSE)
+ *
+ * Host tool running the credential store of the firmware (credentials.c)
+ * on a simulated EEPROM to count the writes of each byte
+ * Usage: wearsim [days] [rotations per day]
+ *
+ * The traffic follows our provisioning: the device is cleared and gets its
+ * initial credentials on the first day, then passwords are rotated every
+ * day, a credential is added every few days (deleting one when the log
+ * would have no room left for updates), the layout changes once and the
+ * device is plugged in a few times a day.
+ * The write count of the hottest bytes and of each EEPROM region are
+ * printed with the days left until the hottest byte wears out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "eequeue.h"
+#include "credentials.h"
+#include "hid.h"
+
+// EEPROM size and write endurance of the ATtiny85 (datasheet p.1)
+#define EEPROM_SIZE 512
+#define EEPROM_CYCLES 100000UL
+// time the EEPROM takes to erase and write a byte, or to only erase or
+// only write it (datasheet p.20), in microseconds
+#define ATOMIC_TIME_US 3400UL
+#define SPLIT_TIME_US 1800UL
+
+// traffic defaults
+#define SIM_DAYS 30
+#define ROTATIONS_PER_DAY 4
+#define INITIAL_CREDS 6
+#define NEW_CRED_EVERY 3
+#define PLUGS_PER_DAY 3
+// layout set halfway through, the third of LAYOUTS in the Makefile (de)
+#define NEW_LAYOUT 2
+// credentials of about 45 bytes the log holds while keeping room for an
+// update
+#define MAX_CREDS 8
+
+#define HOT_BYTES 8
+
+// state of the simulated hardware
+static uint8_t eeprom[EEPROM_SIZE];
+static unsigned long writes[EEPROM_SIZE];
+static unsigned long splitWrites = 0;
+uint8_t simPortB;
+keyboard_report_t keyboard_report;
+
+// numbers of the live credentials in the order of their idNames
+static unsigned int nums[CRED_MAX];
+static unsigned char numCount = 0;
+
+// EEPROM regions in address order
+typedef struct {
+    const char *name;
+    int start;
+    int len;
+} region_t;
+
+static const region_t regions[] = {
+    {"log", 0, LOG_SIZE},
+    {"journal", JOURNAL_LOCATION, JOURNAL_LEN},
+    {"metadata", META_LOCATION, META_SLOTS * META_SLOT_LEN},
+    {"masterkey", MASTERKEY_LOCATION, MASTERKEY_LEN}
+};
+#define REGION_COUNT (sizeof(regions) / sizeof(regions[0]))
+
+// the EEPROM write queue of the firmware once drained
+uint8_t eequeue_ReadByte(const uint8_t *addr) {
+    return eeprom[(uintptr_t)addr % EEPROM_SIZE];
+}
+
+// like the firmware, only bytes that change are written and bytes only
+// erased or only getting bits cleared take the short programming mode
+void eequeue_UpdateByte(uint8_t *addr, uint8_t value) {
+    uintptr_t i = (uintptr_t)addr % EEPROM_SIZE;
+
+    if(eeprom[i] != value) {
+        if(value == 0xFF || (eeprom[i] & value) == value)
+            splitWrites++;
+        eeprom[i] = value;
+        writes[i]++;
+    }
+}
+
+void eequeue_ReadBlock(void *dst, const void *src, size_t n) {
+    size_t i;
+    for(i = 0; i < n; i++)
+        ((uint8_t *)dst)[i] = eequeue_ReadByte((const uint8_t *)src + i);
+}
+
+void eequeue_UpdateBlock(const void *src, void *dst, size_t n) {
+    size_t i;
+    for(i = 0; i < n; i++)
+        eequeue_UpdateByte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+/*
+ * Return the name of the region holding addr
+ */
+static const char *regionName(int addr) {
+    unsigned int i;
+
+    for(i = 0; i < REGION_COUNT; i++) {
+        if(addr >= regions[i].start && addr < regions[i].start + regions[i].len)
+            return regions[i].name;
+    }
+    return "unused";
+}
+
+/*
+ * Return a pseudo random number, the same on every run
+ */
+static unsigned int simRand(void) {
+    static unsigned long seed = 12345;
+
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/*
+ * Run the job started by the last request to its end, like eepromTask
+ */
+static void runJob(void) {
+    while(storeJobStep());
+}
+
+/*
+ * Send a record with its text fields like USB_WRITE_RECORD does
+ * Return the result of closeRecord(), -1 if the log had no room
+ */
+static int sendRecord(const char *fields[FIELD_COUNT]) {
+    unsigned char i, size = 1 + FIELD_COUNT;
+    const char *c;
+    int ret;
+
+    for(i = 0; i < FIELD_COUNT; i++)
+        size += strlen(fields[i]);
+
+    // a compaction opens the record once over, opening it again tells
+    // whether it made room
+    while((ret = openRecord(size)) == STORE_BUSY)
+        runJob();
+    if(ret != 0)
+        return ret;
+
+    for(i = 0; i < FIELD_COUNT; i++) {
+        for(c = fields[i]; *c != '\0'; c++)
+            writeRecord(*c);
+        closeField();
+    }
+    return closeRecord();
+}
+
+/*
+ * Return 1 if the idName of credential a sorts before the one of b like
+ * the firmware lists them
+ */
+static int sortsBefore(unsigned int a, unsigned int b) {
+    char nameA[ID_NAME_LEN + 1], nameB[ID_NAME_LEN + 1];
+
+    snprintf(nameA, sizeof(nameA), "site%u", a);
+    snprintf(nameB, sizeof(nameB), "site%u", b);
+    return strcmp(nameA, nameB) < 0;
+}
+
+/*
+ * Send credential num with a new random password, a new one takes its
+ * place in the order of the idNames
+ * Return 1 if the update failed
+ */
+static unsigned int sendCred(unsigned int num) {
+    static const char chars[] = "abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ23456789!#$%&*+=?";
+    char name[ID_NAME_LEN + 1], username[ID_USERNAME_LEN + 1], password[ID_PASSWORD_LEN + 1];
+    const char *fields[FIELD_COUNT] = {name, username, password};
+    unsigned char i, len = 12 + simRand() % 8;
+
+    snprintf(name, sizeof(name), "site%u", num);
+    snprintf(username, sizeof(username), "user%u@example.com", num);
+    for(i = 0; i < len; i++)
+        password[i] = chars[simRand() % (sizeof(chars) - 1)];
+    password[len] = '\0';
+
+    if(sendRecord(fields) != 0)
+        return 1;
+
+    for(i = 0; i < numCount && nums[i] != num; i++);
+    if(i < numCount)
+        return 0;
+
+    for(i = numCount++; i > 0 && sortsBefore(num, nums[i - 1]); i--)
+        nums[i] = nums[i - 1];
+    nums[i] = num;
+    return 0;
+}
+
+/*
+ * Delete credential idNum (1 based)
+ */
+static void deleteCred(unsigned char idNum) {
+    unsigned char i;
+
+    deleteCredential(idNum);
+    runJob();
+    for(i = idNum - 1; i + 1 < numCount; i++)
+        nums[i] = nums[i + 1];
+    numCount--;
+}
+
+/*
+ * Plug the device in: mount the store and check nothing was recovered,
+ * a mount after a clean unplug writes nothing
+ */
+static void plug(void) {
+    mount_stats_t stats;
+
+    mountStore(&stats);
+    if(stats.recovered)
+        fprintf(stderr, "mount recovered 0x%02X without a power loss\n", stats.recovered);
+    runJob();
+}
+
+int main(int argc, char **argv) {
+    unsigned int days = SIM_DAYS, rotations = ROTATIONS_PER_DAY;
+    unsigned int day, i, nextNum = 0, failed = 0;
+    unsigned long total = 0, max;
+    int addr, hot[HOT_BYTES];
+    char masterKey[MASTERKEY_LEN] = "secret";
+
+    if(argc > 3 || (argc > 1 && (days = atoi(argv[1])) == 0) ||
+       (argc > 2 && (rotations = atoi(argv[2])) == 0)) {
+        fprintf(stderr, "Usage: wearsim [days] [rotations per day]\n");
+        return 1;
+    }
+
+    // a new device, initialized and provisioned
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    plug();
+    clearEEPROM(1);
+    runJob();
+    setMasterKey(masterKey);
+    for(; nextNum < INITIAL_CREDS; nextNum++)
+        failed += sendCred(nextNum);
+
+    for(day = 0; day < days; day++) {
+        for(i = 0; i < PLUGS_PER_DAY; i++)
+            plug();
+
+        // passwords rotated on random credentials
+        for(i = 0; i < rotations && numCount > 0; i++)
+            failed += sendCred(nums[simRand() % numCount]);
+
+        if(day % NEW_CRED_EVERY == NEW_CRED_EVERY - 1) {
+            if(numCount >= MAX_CREDS)
+                deleteCred(1 + simRand() % numCount);
+            failed += sendCred(nextNum++);
+        }
+
+        if(day == days / 2) {
+            // same order as the firmware, the encoder already uses the new one
+            setKeyboardLayout(NEW_LAYOUT);
+            setLayout(NEW_LAYOUT);
+        }
+    }
+
+    if(credCount != numCount)
+        fprintf(stderr, "the store holds %u credentials instead of %u\n", credCount, numCount);
+    printf("%u days, %u rotations per day, %u credentials at the end, %u updates failed\n\n",
+           days, rotations, credCount, failed);
+
+    printf("region      bytes   writes  max/byte  mean/byte\n");
+    for(i = 0; i < REGION_COUNT; i++) {
+        unsigned long sum = 0;
+        max = 0;
+        for(addr = regions[i].start; addr < regions[i].start + regions[i].len; addr++) {
+            sum += writes[addr];
+            if(writes[addr] > max)
+                max = writes[addr];
+        }
+        total += sum;
+        printf("%-10s %6d %8lu %9lu %10.1f\n", regions[i].name, regions[i].len, sum, max,
+               (double)sum / regions[i].len);
+    }
+    printf("total             %8lu  (%.1f s programming, %lu bytes in 1.8 ms modes)\n\n", total,
+           (splitWrites * SPLIT_TIME_US + (total - splitWrites) * ATOMIC_TIME_US) / 1000000.0,
+           splitWrites);
+
+    // selection of the hottest bytes, ties keep the lowest address
+    printf("hottest bytes\n");
+    for(i = 0; i < HOT_BYTES; i++) {
+        unsigned int j;
+        hot[i] = -1;
+        for(addr = 0; addr < EEPROM_SIZE; addr++) {
+            for(j = 0; j < i && hot[j] != addr; j++);
+            if(j == i && (hot[i] < 0 || writes[addr] > writes[hot[i]]))
+                hot[i] = addr;
+        }
+        printf("  0x%03X %-10s %8lu\n", hot[i], regionName(hot[i]), writes[hot[i]]);
+    }
+
+    max = writes[hot[0]];
+    if(max > 0)
+        printf("\nthe hottest byte wears out after %lu days\n", EEPROM_CYCLES * days / max);
+
+    return failed != 0;
+}
@@ -10,35 +10,49 @@
 #include <avr/interrupt.h>
 #include "timer1.h"
 
-volatile unsigned char counter100ms = 0;
+// milliseconds since boot
+static volatile unsigned int ticks = 0;
 
-// interrupt routine for timer1 every 100ms
-ISR(TIM1_OVF_vect) {
-    TCNT1 = 55;
-
-    // increment 100ms counter
-    counter100ms++;
-    // reset counter after 2s
-    if(counter100ms == 20)
-        counter100ms = 0;
+// interrupt routine for timer1 every 1ms
+// interrupts are enabled right away so the USB interrupt is never delayed
+ISR(TIM1_COMPA_vect, ISR_NOBLOCK) {
+    ticks++;
 }
 
 /*
  * Timer1 initialization
- * Prescaler = 8192
- * Overflow 10x per second (100ms)
+ * Prescaler = 128
+ * Clear on compare match with OCR1C, 1000x per second (1ms)
  *
  */
 void timer1_Init(void) {
-    // timer1 prescaler select (datasheet p.89)
-    TCCR1 |=  (1<<CS13)|(1<<CS12)|(1<<CS11);
-    TCCR1 &= ~(1<<CS10);
-
-    // timer1 interrupt enable (datasheet p.81)
-    TIMSK |= (1<<TOIE1);
-
     // reset initial values
-    counter100ms = 0;
+    ticks = 0;
     TCNT1 = 0;
 
+    // compare match A at the top value (datasheet p.89)
+    OCR1C = TIMER1_TOP;
+    OCR1A = TIMER1_TOP;
+
+    // CTC mode and timer1 prescaler select
+    TCCR1 = (1<<CTC1)|(1<<CS13);
+
+    // timer1 compare match A interrupt enable (datasheet p.92)
+    TIMSK |= (1<<OCIE1A);
+}
+
+/*
+ * Return the milliseconds elapsed since boot
+ * It wraps after ~65s so only differences between values make sense
+ *
+ */
+unsigned int timer1_Now(void) {
+    unsigned int now;
+    unsigned char sreg = SREG;
+
+    cli();
+    now = ticks;
+    SREG = sreg;
+
+    return now;
 }
@@ -10,9 +10,11 @@
 #ifndef TIMER1_H
 #define TIMER1_H
 
-extern volatile unsigned char counter100ms;
+// timer1 counts F_CPU / 128, compare match every OCR1C + 1 counts (~1ms)
+#define TIMER1_TOP ((F_CPU / 128 + 500) / 1000 - 1)
 
 // prototypes
 void timer1_Init(void);
+unsigned int timer1_Now(void);
 
 #endif